@@ -0,0 +1,183 @@
+#include "accesslog.h"
+#include <algorithm>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <format>
+#include <netinet/in.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <utility>
+
+namespace accesslog {
+namespace {
+
+int64_t nanoseconds(AccessLog::clock::time_point t) noexcept {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             t.time_since_epoch())
+      .count();
+}
+
+} // namespace
+
+std::filesystem::path worker_file(std::string_view prefix,
+                                  std::size_t worker) {
+  return std::format("{}.{}.bin", prefix, worker);
+}
+
+wnet::Result<AccessLog> AccessLog::open(const std::filesystem::path &path,
+                                        uint32_t worker) {
+  wnet::FileDescriptor fd{
+      ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)};
+  if (!fd) {
+    return wnet::errno_error();
+  }
+
+  AccessLog log{std::move(fd)};
+  if (!log.map_chunk(0)) {
+    return wnet::errno_error();
+  }
+
+  timespec wall{};
+  ::clock_gettime(CLOCK_REALTIME, &wall);
+  const auto now = clock::now();
+
+  FileHeader header{};
+  std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = VERSION;
+  header.record_size = RECORD_SIZE;
+  header.wall_ns = wall.tv_sec * 1'000'000'000LL + wall.tv_nsec;
+  header.monotonic_ns = nanoseconds(now);
+  header.worker = worker;
+  std::memcpy(log.next_slot(), &header, sizeof(header));
+  return log;
+}
+
+AccessLog::AccessLog(AccessLog &&other) noexcept
+    : _fd(std::move(other._fd)), _chunk(std::exchange(other._chunk, nullptr)),
+      _chunk_offset(other._chunk_offset), _used(other._used),
+      _paths(std::move(other._paths)) {}
+
+AccessLog &AccessLog::operator=(AccessLog &&other) noexcept {
+  if (this != &other) {
+    unmap();
+    _fd = std::move(other._fd);
+    _chunk = std::exchange(other._chunk, nullptr);
+    _chunk_offset = other._chunk_offset;
+    _used = other._used;
+    _paths = std::move(other._paths);
+  }
+  return *this;
+}
+
+AccessLog::~AccessLog() { unmap(); }
+
+void AccessLog::unmap() noexcept {
+  if (_chunk != nullptr) {
+    ::munmap(_chunk, CHUNK_SIZE);
+    _chunk = nullptr;
+  }
+  if (_fd) { // drop the unused, zeroed tail of the last chunk
+    (void)::ftruncate(_fd.get(), static_cast<off_t>(_chunk_offset + _used));
+  }
+}
+
+bool AccessLog::map_chunk(std::size_t offset) noexcept {
+  if (::ftruncate(_fd.get(), static_cast<off_t>(offset + CHUNK_SIZE)) != 0) {
+    return false;
+  }
+  void *chunk = ::mmap(nullptr, CHUNK_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED,
+                       _fd.get(), static_cast<off_t>(offset));
+  if (chunk == MAP_FAILED) {
+    return false;
+  }
+  _chunk = static_cast<char *>(chunk);
+  _chunk_offset = offset;
+  _used = 0;
+  return true;
+}
+
+char *AccessLog::next_slot() noexcept {
+  if (_chunk == nullptr) {
+    return nullptr;
+  }
+  if (_used == CHUNK_SIZE) {
+    ::munmap(_chunk, CHUNK_SIZE);
+    _chunk = nullptr;
+    if (!map_chunk(_chunk_offset + CHUNK_SIZE)) {
+      return nullptr; // unmap() trims the file back to what was written
+    }
+  }
+  char *slot = _chunk + _used;
+  _used += RECORD_SIZE;
+  return slot;
+}
+
+uint32_t AccessLog::intern(std::string_view path) {
+  if (auto it = _paths.find(path); it != _paths.end()) {
+    return it->second;
+  }
+  if (_paths.size() >= MAX_PATHS || _chunk == nullptr) {
+    return NO_PATH;
+  }
+
+  const auto id = static_cast<uint32_t>(_paths.size() + 1);
+  const auto text = path.substr(0, MAX_PATH_LENGTH);
+  char *slot = next_slot();
+  if (slot == nullptr) {
+    return NO_PATH;
+  }
+  const PathRecord record{.type = RecordType::Path,
+                          .reserved = 0,
+                          .length = static_cast<uint16_t>(text.size()),
+                          .path_id = id};
+  std::memcpy(slot, &record, sizeof(record));
+
+  // the text fills the rest of this slot, then whole slots after it
+  std::size_t copied = std::min(text.size(), RECORD_SIZE - sizeof(record));
+  std::memcpy(slot + sizeof(record), text.data(), copied);
+  while (copied < text.size()) {
+    slot = next_slot();
+    if (slot == nullptr) {
+      return NO_PATH;
+    }
+    const std::size_t n = std::min(text.size() - copied, RECORD_SIZE);
+    std::memcpy(slot, text.data() + copied, n);
+    copied += n;
+  }
+
+  _paths.emplace(path, id);
+  return id;
+}
+
+void AccessLog::record(const wnet::SocketAddr &client, HttpRequestType method,
+                       uint32_t path_id, uint16_t status, uint64_t bytes,
+                       clock::time_point start,
+                       clock::time_point end) noexcept {
+  char *slot = next_slot();
+  if (slot == nullptr) {
+    return;
+  }
+
+  AccessRecord record{};
+  record.type = RecordType::Access;
+  record.method = static_cast<uint8_t>(method);
+  record.path_id = path_id;
+  record.start_ns = nanoseconds(start);
+  record.latency_ns = static_cast<uint64_t>(nanoseconds(end) - record.start_ns);
+  record.bytes = bytes;
+  record.status = status;
+  record.port = client.port();
+  if (client.is_v6()) {
+    const auto *in6 = reinterpret_cast<const sockaddr_in6 *>(client.asCType());
+    record.family = 6;
+    std::memcpy(record.address, &in6->sin6_addr, sizeof(in6->sin6_addr));
+  } else {
+    const auto *in = reinterpret_cast<const sockaddr_in *>(client.asCType());
+    record.family = 4;
+    std::memcpy(record.address, &in->sin_addr, sizeof(in->sin_addr));
+  }
+  std::memcpy(slot, &record, sizeof(record));
+}
+
+} // namespace accesslog
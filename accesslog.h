@@ -0,0 +1,134 @@
+#ifndef ACCESSLOG_H_
+#define ACCESSLOG_H_
+#include "http.h"
+#include "socket.h"
+#include "stringhash.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <string>
+#include <string_view>
+
+// **************************************************************************************
+// * Binary access log
+// * -- one record per response, appended to a file that is mapped into
+// *    memory, so logging a request is a few stores into the page cache: no
+// *    formatting, no allocation and no syscall. The pages belong to the
+// *    kernel, so records survive a crash of the server. accesslogdecode
+// *    renders the files as text or JSON offline.
+// *
+// *    Layout: a FileHeader, then RECORD_SIZE slots. Timestamps are
+// *    steady_clock (CLOCK_MONOTONIC) nanoseconds; the header pairs the
+// *    monotonic and wall clocks at open so they can be turned into dates.
+// *    A path is written once, as a PathRecord that assigns it an id, and
+// *    access records carry only the id. A slot whose type is End (zero,
+// *    what a grown file is filled with) ends the log.
+// **************************************************************************************
+namespace accesslog {
+
+inline constexpr char MAGIC[8] = {'W', 'S', 'A', 'C', 'C', 'L', 'O', 'G'};
+inline constexpr uint32_t VERSION = 1;
+inline constexpr std::size_t RECORD_SIZE = 64;
+
+enum class RecordType : uint8_t { End = 0, Access = 1, Path = 2 };
+
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  int64_t wall_ns;      // CLOCK_REALTIME ...
+  int64_t monotonic_ns; // ... and steady_clock at the same instant
+  uint32_t worker;
+  uint8_t reserved[28];
+};
+
+struct AccessRecord {
+  RecordType type; // Access
+  uint8_t method;  // HttpRequestType
+  uint8_t family;  // 4 or 6
+  uint8_t reserved0;
+  uint32_t path_id; // NO_PATH if the request had none or was not interned
+  int64_t start_ns; // when its first byte arrived
+  uint64_t latency_ns; // until its last byte was handed to the kernel
+  uint64_t bytes;      // of the response that were sent
+  uint16_t status;
+  uint16_t port;
+  uint32_t reserved1;
+  uint8_t address[16]; // network byte order; IPv4 uses the first 4 bytes
+  uint8_t reserved2[8];
+};
+
+// The path text follows the record and continues into as many further slots
+// as it needs.
+struct PathRecord {
+  RecordType type; // Path
+  uint8_t reserved;
+  uint16_t length;
+  uint32_t path_id;
+};
+
+static_assert(sizeof(FileHeader) == RECORD_SIZE);
+static_assert(sizeof(AccessRecord) == RECORD_SIZE);
+static_assert(sizeof(PathRecord) <= RECORD_SIZE);
+
+inline constexpr uint32_t NO_PATH = 0;
+inline constexpr std::size_t MAX_PATH_LENGTH = 1024; // longer ones are cut
+// distinct paths interned per file; requests for others are logged as
+// NO_PATH, so a client cycling through paths cannot grow the table forever
+inline constexpr std::size_t MAX_PATHS = 4096;
+
+// The file each worker writes under the -A prefix.
+[[nodiscard]] std::filesystem::path worker_file(std::string_view prefix,
+                                                std::size_t worker);
+
+// One worker's log; not thread-safe, every worker owns its own file.
+class AccessLog {
+public:
+  using clock = std::chrono::steady_clock;
+
+  // the file grows (and is mapped) this much at a time
+  static constexpr std::size_t CHUNK_SIZE = 1024 * 1024;
+
+  // Creates (or truncates) `path`.
+  [[nodiscard]] static wnet::Result<AccessLog>
+  open(const std::filesystem::path &path, uint32_t worker);
+
+  AccessLog(AccessLog &&other) noexcept;
+  AccessLog &operator=(AccessLog &&other) noexcept;
+  AccessLog(const AccessLog &) = delete;
+  AccessLog &operator=(const AccessLog &) = delete;
+  // trims the file to the records written
+  ~AccessLog();
+
+  // The id for `path`, written to the file the first time it is seen.
+  [[nodiscard]] uint32_t intern(std::string_view path);
+
+  void record(const wnet::SocketAddr &client, HttpRequestType method,
+              uint32_t path_id, uint16_t status, uint64_t bytes,
+              clock::time_point start, clock::time_point end) noexcept;
+
+  // false once the file could not be grown; records are dropped from then on
+  [[nodiscard]] bool is_valid() const noexcept { return _chunk != nullptr; }
+
+private:
+  explicit AccessLog(wnet::FileDescriptor fd) noexcept : _fd(std::move(fd)) {}
+
+  // maps the chunk at `offset`, growing the file to hold it
+  [[nodiscard]] bool map_chunk(std::size_t offset) noexcept;
+
+  // the next free slot, mapping a new chunk when the current one is full;
+  // nullptr if that failed
+  [[nodiscard]] char *next_slot() noexcept;
+  void unmap() noexcept;
+
+  wnet::FileDescriptor _fd;
+  char *_chunk{nullptr};        // the mapped end of the file
+  std::size_t _chunk_offset{0}; // of _chunk in the file
+  std::size_t _used{0};         // bytes of _chunk written
+  StringMap<uint32_t> _paths;
+};
+
+} // namespace accesslog
+
+#endif
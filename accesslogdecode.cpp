@@ -0,0 +1,219 @@
+// **************************************************************************************
+// * accesslogdecode
+// * -- renders the binary access logs written by webServer -A as text (one
+// *    line per request) or, with -j, as JSON lines.
+// *
+// *    Usage: accesslogdecode [-j] FILE...
+// **************************************************************************************
+#include "accesslog.h"
+#include <algorithm>
+#include <arpa/inet.h>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+using namespace accesslog;
+
+std::string_view method_name(uint8_t method) {
+  switch (static_cast<HttpRequestType>(method)) {
+  case HttpRequestType::GET:
+    return "GET";
+  case HttpRequestType::HEAD:
+    return "HEAD";
+  case HttpRequestType::POST:
+    return "POST";
+  default:
+    return "-";
+  }
+}
+
+// ISO 8601 UTC with microseconds
+std::string format_time(int64_t wall_ns) {
+  const time_t seconds = wall_ns / 1'000'000'000;
+  tm utc{};
+  gmtime_r(&seconds, &utc);
+  char date[32];
+  std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", &utc);
+  return std::format("{}.{:06}Z", date, wall_ns % 1'000'000'000 / 1000);
+}
+
+std::string format_address(const AccessRecord &record) {
+  char text[INET6_ADDRSTRLEN] = "-";
+  inet_ntop(record.family == 6 ? AF_INET6 : AF_INET, record.address, text,
+            sizeof(text));
+  return text;
+}
+
+// Length of the well-formed UTF-8 sequence `s` starts with (RFC 3629: no
+// overlong forms, surrogates or code points past U+10FFFF), or 0.
+std::size_t utf8_length(std::string_view s) {
+  const auto byte = [&](std::size_t i) {
+    return static_cast<unsigned char>(s[i]);
+  };
+  const unsigned char lead = byte(0);
+  std::size_t length;
+  unsigned char low = 0x80, high = 0xbf; // range of the second byte
+  if (lead >= 0xc2 && lead <= 0xdf) {
+    length = 2;
+  } else if (lead >= 0xe0 && lead <= 0xef) {
+    length = 3;
+    low = lead == 0xe0 ? 0xa0 : 0x80;
+    high = lead == 0xed ? 0x9f : 0xbf;
+  } else if (lead >= 0xf0 && lead <= 0xf4) {
+    length = 4;
+    low = lead == 0xf0 ? 0x90 : 0x80;
+    high = lead == 0xf4 ? 0x8f : 0xbf;
+  } else {
+    return 0;
+  }
+  if (s.size() < length || byte(1) < low || byte(1) > high) {
+    return 0;
+  }
+  for (std::size_t i = 2; i < length; ++i) {
+    if (byte(i) < 0x80 || byte(i) > 0xbf) {
+      return 0;
+    }
+  }
+  return length;
+}
+
+// JSON text is UTF-8: well-formed UTF-8 in a path passes through, and any
+// other byte from 0x80 up is written as the code point of the same value
+std::string json_escape(std::string_view s) {
+  std::string out;
+  for (std::size_t i = 0; i < s.size();) {
+    const auto c = static_cast<unsigned char>(s[i]);
+    if (c >= 0x80) {
+      if (const std::size_t n = utf8_length(s.substr(i))) {
+        out.append(s.substr(i, n));
+        i += n;
+      } else {
+        out += std::format("\\u{:04x}", c);
+        ++i;
+      }
+      continue;
+    }
+    if (c == '"' || c == '\\') {
+      out += '\\';
+      out += static_cast<char>(c);
+    } else if (c < 0x20 || c == 0x7f) {
+      out += std::format("\\u{:04x}", c);
+    } else {
+      out += static_cast<char>(c);
+    }
+    ++i;
+  }
+  return out;
+}
+
+// false if `path` is not an access log
+bool decode(const char *path, bool json) {
+  std::ifstream in(path, std::ios::binary);
+  if (!in) {
+    std::cerr << std::format("{}: cannot open\n", path);
+    return false;
+  }
+  const std::vector<char> bytes{std::istreambuf_iterator<char>(in), {}};
+
+  FileHeader header;
+  if (bytes.size() < sizeof(header)) {
+    std::cerr << std::format("{}: too short for an access log\n", path);
+    return false;
+  }
+  std::memcpy(&header, bytes.data(), sizeof(header));
+  if (std::memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0 ||
+      header.version != VERSION || header.record_size != RECORD_SIZE) {
+    std::cerr << std::format("{}: not a version {} access log\n", path,
+                             VERSION);
+    return false;
+  }
+
+  std::unordered_map<uint32_t, std::string> paths;
+  std::string out;
+  for (std::size_t offset = sizeof(header);
+       offset + RECORD_SIZE <= bytes.size(); offset += RECORD_SIZE) {
+    const char *slot = bytes.data() + offset;
+    const auto type = static_cast<RecordType>(*slot);
+
+    if (type == RecordType::Path) {
+      PathRecord record;
+      std::memcpy(&record, slot, sizeof(record));
+      const std::size_t start = offset + sizeof(record);
+      const std::size_t length =
+          std::min<std::size_t>(record.length, bytes.size() - start);
+      paths[record.path_id].assign(bytes.data() + start, length);
+      // skip the slots the text continued into
+      const std::size_t extra = sizeof(record) + length;
+      offset += (extra - 1) / RECORD_SIZE * RECORD_SIZE;
+      continue;
+    }
+    if (type != RecordType::Access) {
+      break; // End: the rest of the file was never written
+    }
+
+    AccessRecord record;
+    std::memcpy(&record, slot, sizeof(record));
+    const auto found = paths.find(record.path_id);
+    const std::string_view request_path =
+        found == paths.end() ? std::string_view{"-"} : found->second;
+    const auto time =
+        format_time(header.wall_ns + (record.start_ns - header.monotonic_ns));
+    const double latency_us = static_cast<double>(record.latency_ns) / 1000.0;
+
+    if (json) {
+      out += std::format(
+          "{{\"time\":\"{}\",\"worker\":{},\"client\":\"{}\",\"port\":{},"
+          "\"method\":\"{}\",\"path\":\"{}\",\"status\":{},\"bytes\":{},"
+          "\"latency_us\":{:.1f}}}\n",
+          time, header.worker, format_address(record), record.port,
+          method_name(record.method), json_escape(request_path),
+          record.status, record.bytes, latency_us);
+    } else {
+      out += std::format("{} {} {} {} {} {} {} {:.1f}us\n", time,
+                         header.worker, format_address(record),
+                         method_name(record.method), request_path,
+                         record.status, record.bytes, latency_us);
+    }
+    if (out.size() >= 64 * 1024) {
+      std::cout << out;
+      out.clear();
+    }
+  }
+  std::cout << out;
+  return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  bool json = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "j")) != -1) {
+    if (opt != 'j') {
+      std::cerr << std::format("Usage: {} [-j] FILE...\n", argv[0]);
+      return -1;
+    }
+    json = true;
+  }
+  if (optind == argc) {
+    std::cerr << std::format("Usage: {} [-j] FILE...\n", argv[0]);
+    return -1;
+  }
+
+  bool ok = true;
+  for (int i = optind; i < argc; ++i) {
+    ok = decode(argv[i], json) && ok;
+  }
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,84 @@
+// **************************************************************************************
+// * bench_routes
+// * -- times is_valid_filename()'s lookup: the RouteTable perfect hash the
+// *    server uses against the std::regex it replaced, over the same mix of
+// *    servable and unservable paths, and checks that both give the same
+// *    answers.
+// *
+// *    Usage: bench_routes [LOOKUPS]   (make bench builds it with -O2 and runs it)
+// **************************************************************************************
+#include "routes.h"
+#include <chrono>
+#include <cstddef>
+#include <format>
+#include <iostream>
+#include <regex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+// every servable path, plus near misses and junk
+std::vector<std::string> sample_paths() {
+  std::vector<std::string> paths;
+  for (char digit = '0'; digit <= '9'; ++digit) {
+    paths.push_back(std::format("/file{}.html", digit));
+    paths.push_back(std::format("/image{}.jpg", digit));
+    paths.push_back(std::format("/file{}.htm", digit));
+    paths.push_back(std::format("/image{}{}.jpg", digit, digit));
+  }
+  paths.insert(paths.end(), {"/", "/index.html", "/favicon.ico",
+                             "/badname.html", "/../etc/passwd",
+                             "/file1.html/", "/FILE1.HTML", "/image.jpg"});
+  return paths;
+}
+
+// runs `valid` over `paths` until `lookups` have been done; returns the
+// nanoseconds per lookup and sets `hits`
+template <typename F>
+double time_lookups(const std::vector<std::string> &paths, std::size_t lookups,
+                    F &&valid, std::size_t &hits) {
+  hits = 0;
+  const auto start = std::chrono::steady_clock::now();
+  for (std::size_t i = 0; i < lookups; ++i) {
+    hits += valid(std::string_view{paths[i % paths.size()]}) ? 1 : 0;
+  }
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  return static_cast<double>(
+             std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed)
+                 .count()) /
+         static_cast<double>(lookups);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+  const std::size_t lookups = argc > 1 ? std::stoul(argv[1]) : 2'000'000;
+  const auto paths = sample_paths();
+
+  const std::regex pattern{R"(^/(file[0-9]\.html|image[0-9]\.jpg)$)"};
+  const auto regex = [&](std::string_view path) {
+    return std::regex_match(path.begin(), path.end(), pattern);
+  };
+  const auto table = [](std::string_view path) {
+    return SERVABLE_PATHS.contains(path);
+  };
+
+  for (const auto &path : paths) {
+    if (regex(path) != table(path)) {
+      std::cerr << std::format("{}: regex and route table disagree\n", path);
+      return 1;
+    }
+  }
+
+  std::size_t regex_hits = 0, table_hits = 0;
+  const double regex_ns = time_lookups(paths, lookups, regex, regex_hits);
+  const double table_ns = time_lookups(paths, lookups, table, table_hits);
+
+  std::cout << std::format("{} lookups over {} paths ({} servable)\n",
+                           lookups, paths.size(), table_hits);
+  std::cout << std::format("  std::regex   {:>8.1f} ns/lookup\n", regex_ns);
+  std::cout << std::format("  RouteTable   {:>8.1f} ns/lookup\n", table_ns);
+  return regex_hits == table_hits ? 0 : 1;
+}
@@ -0,0 +1,62 @@
+#include "buffer.h"
+#include "socket.h"
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <span>
+
+namespace wnet {
+
+RecvBuffer::RecvBuffer(std::size_t chunk_size) : _chunk_size(chunk_size) {}
+
+std::span<char> RecvBuffer::prepare(std::size_t n) {
+  if (_capacity - _end >= n) {
+    return {_data.get() + _end, n};
+  }
+
+  if (_begin > 0 && _capacity - size() >= n) {
+    // enough room once the consumed prefix is dropped; usually only a few
+    // leftover bytes of a pipelined request have to move
+    std::memmove(_data.get(), _data.get() + _begin, size());
+  } else {
+    const std::size_t new_capacity = std::max(_capacity * 2, size() + n);
+    auto data = std::make_unique<char[]>(new_capacity);
+    if (!empty()) {
+      std::memcpy(data.get(), _data.get() + _begin, size());
+    }
+    _data = std::move(data);
+    _capacity = new_capacity;
+  }
+
+  _end -= _begin;
+  _begin = 0;
+  return {_data.get() + _end, n};
+}
+
+Result<std::size_t> RecvBuffer::fill(Socket &socket) {
+  auto space = prepare(_chunk_size);
+  auto received = socket.recv(space);
+  if (received) {
+    _end += *received;
+  }
+  return received;
+}
+
+void RecvBuffer::append(std::span<const char> data) {
+  auto space = prepare(data.size());
+  std::memcpy(space.data(), data.data(), data.size());
+  _end += data.size();
+}
+
+void RecvBuffer::consume(std::size_t n) noexcept {
+  _begin += std::min(n, size());
+  if (_begin == _end) { // nothing left: start over at the front for free
+    _begin = _end = 0;
+  }
+}
+
+void RecvBuffer::clear() noexcept {
+  _begin = _end = 0;
+}
+
+} // namespace wnet
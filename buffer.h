@@ -0,0 +1,55 @@
+#ifndef BUFFER_H_
+#define BUFFER_H_
+#include <cstddef>
+#include "socket.h"
+#include <memory>
+#include <span>
+#include <string_view>
+
+namespace wnet {
+
+// Per-connection receive buffer. Bytes are pulled from the socket in large
+// chunks straight into spare capacity, looked at through string_views, and
+// only dropped with consume() once the caller is done with them, so whatever
+// follows a request (e.g. the next pipelined one) stays buffered.
+//
+// Views returned by view() are invalidated by fill(), append() and
+// consume().
+class RecvBuffer {
+public:
+  static constexpr std::size_t DEFAULT_CHUNK = 4096;
+
+  explicit RecvBuffer(std::size_t chunk_size = DEFAULT_CHUNK);
+
+  RecvBuffer(RecvBuffer &&other) noexcept = default;
+  RecvBuffer &operator=(RecvBuffer &&other) noexcept = default;
+  RecvBuffer(const RecvBuffer &) = delete;
+  RecvBuffer &operator=(const RecvBuffer &) = delete;
+
+  // One recv() of up to a chunk into the buffer: the bytes received, 0 if the
+  // peer closed, or the recv() error (check it with wnet::would_block()).
+  [[nodiscard]] Result<std::size_t> fill(Socket &socket);
+  // for engines that receive somewhere else (e.g. io_uring provided buffers)
+  void append(std::span<const char> data);
+
+  void consume(std::size_t n) noexcept;
+  void clear() noexcept;
+
+  [[nodiscard]] std::string_view view() const noexcept {
+    return {_data.get() + _begin, _end - _begin};
+  }
+  [[nodiscard]] std::size_t size() const noexcept { return _end - _begin; }
+  [[nodiscard]] bool empty() const noexcept { return _begin == _end; }
+
+private:
+  std::span<char> prepare(std::size_t n); // room for n more bytes at _end
+
+  std::unique_ptr<char[]> _data;
+  std::size_t _capacity{0};
+  std::size_t _chunk_size;
+  std::size_t _begin{0}; // first unconsumed byte
+  std::size_t _end{0};   // one past the last received byte
+};
+
+} // namespace wnet
+#endif
@@ -0,0 +1,300 @@
+#include "filecache.h"
+#include "logging.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+std::string_view get_content_type(std::string_view filename) {
+  if (filename.ends_with(".html")) {
+    return "text/html";
+  } else if (filename.ends_with(".jpg") || filename.ends_with(".jpeg")) {
+    return "image/jpeg";
+  } else {
+    return "application/octet-stream";
+  }
+}
+
+FileCache::FileCache(std::filesystem::path root, HeaderBuilder make_header,
+                     std::size_t budget_bytes, std::chrono::milliseconds ttl,
+                     std::size_t max_file_size)
+    : _root(std::move(root)), _make_header(make_header), _budget(budget_bytes),
+      _ttl(ttl), _max_file_size(max_file_size) {}
+
+std::filesystem::path FileCache::resolve(std::string_view path) const {
+  if (path.starts_with('/')) {
+    path.remove_prefix(1);
+  }
+  return _root / path;
+}
+
+FileInfo &FileCache::store(std::string_view path, const struct stat &st) {
+  auto it = _entries.find(path);
+  if (it == _entries.end()) {
+    it = _entries.emplace(std::string{path}, Entry{}).first;
+  }
+
+  Entry &entry = it->second;
+  const bool changed = entry.info.size != static_cast<std::size_t>(st.st_size) ||
+                       entry.info.mtime.tv_sec != st.st_mtim.tv_sec ||
+                       entry.info.mtime.tv_nsec != st.st_mtim.tv_nsec;
+  if (changed) {
+    drop_response(entry); // the precomputed bytes describe the old file
+  }
+
+  entry.info = FileInfo{.size = static_cast<std::size_t>(st.st_size),
+                        .mtime = st.st_mtim,
+                        .content_type = get_content_type(path)};
+  entry.validated = clock::now();
+  return entry.info;
+}
+
+FileCache::Entries::iterator FileCache::revalidate(std::string_view path) {
+  auto it = _entries.find(path);
+  if (it != _entries.end() &&
+      (_watching || clock::now() - it->second.validated < _ttl)) {
+    return it;
+  }
+
+  const auto fp = resolve(path);
+  struct stat st {};
+  if (::stat(fp.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    DEBUGL << std::format("File not found: {}", fp.string()) << ENDL;
+    invalidate(path);
+    return _entries.end();
+  }
+
+  store(path, st);
+  return _entries.find(path);
+}
+
+std::shared_ptr<const CachedResponse> FileCache::response(std::string_view path,
+                                                          bool load) {
+  auto it = revalidate(path);
+  if (it == _entries.end()) {
+    return nullptr;
+  }
+
+  Entry &entry = it->second;
+  if (entry.response) {
+    entry.referenced = true;
+    return entry.response;
+  }
+
+  return load ? this->load(path, entry) : nullptr;
+}
+
+std::shared_ptr<const CachedResponse> FileCache::load(std::string_view path,
+                                                      Entry &entry) {
+  // checked before the file is opened, and again below on what fstat() saw
+  if (entry.info.size > _max_file_size || entry.info.size > _budget) {
+    return nullptr; // served with sendfile() instead
+  }
+
+  // open() refreshes entry.info from the fd, so everything below is built
+  // from that one fstat() and a file replaced in between is never mixed in
+  auto file = open(path);
+  if (!file) {
+    return nullptr; // gone since it was stat()ed; retry next time
+  }
+  const FileInfo &info = file->info;
+  if (info.size > _max_file_size || info.size > _budget) {
+    return nullptr;
+  }
+
+  // counted against the budget together with its two header variants
+  auto response = std::make_shared<CachedResponse>();
+  response->info = info;
+  response->bytes = _make_header(info, {});
+  response->header_size = response->bytes.size();
+  response->close_header = _make_header(info, "close");
+  response->keep_alive_header = _make_header(info, "keep-alive");
+  const std::size_t total = response->memory() + info.size;
+  if (total > _budget) {
+    return nullptr;
+  }
+  response->bytes.resize(response->header_size + info.size);
+
+  // never read past the buffer, even if the file grows while it is read
+  const std::size_t body_size = response->bytes.size() - response->header_size;
+  std::size_t offset = 0;
+  while (offset < body_size) {
+    ssize_t got = ::pread(file->fd.get(),
+                          response->bytes.data() + response->header_size + offset,
+                          body_size - offset, static_cast<off_t>(offset));
+    if (got <= 0) {
+      ERROR << std::format("Cannot read file: {}", resolve(path).string())
+            << ENDL;
+      return nullptr;
+    }
+    offset += static_cast<std::size_t>(got);
+  }
+
+  make_room(total);
+  entry.response = std::move(response);
+  entry.referenced = true;
+  _resident.push_back(&entry);
+  _used += total;
+
+  DEBUGL << std::format("Cached {} ({} bytes, {} of {} in use)", path, total,
+                        _used, _budget)
+         << ENDL;
+  return entry.response;
+}
+
+void FileCache::make_room(std::size_t bytes) {
+  while (_used + bytes > _budget && !_resident.empty()) {
+    if (_hand >= _resident.size()) {
+      _hand = 0;
+    }
+
+    Entry *entry = _resident[_hand];
+    if (entry->referenced) { // second chance
+      entry->referenced = false;
+      ++_hand;
+      continue;
+    }
+
+    drop_response(*entry); // refills _resident[_hand], so no advance
+  }
+}
+
+void FileCache::drop_response(Entry &entry) {
+  if (!entry.response) {
+    return;
+  }
+
+  auto it = std::find(_resident.begin(), _resident.end(), &entry);
+  if (it != _resident.end()) {
+    *it = _resident.back(); // ring order is not significant
+    _resident.pop_back();
+  }
+
+  _used -= entry.response->memory();
+  entry.response.reset(); // senders still holding it keep the bytes alive
+  entry.referenced = false;
+}
+
+std::optional<FileInfo> FileCache::info(std::string_view path) {
+  auto it = revalidate(path);
+  if (it == _entries.end()) {
+    return std::nullopt;
+  }
+  return it->second.info;
+}
+
+std::optional<OpenFile> FileCache::open(std::string_view path) {
+  const auto fp = resolve(path);
+  wnet::FileDescriptor fd{::open(fp.c_str(), O_RDONLY | O_CLOEXEC)};
+  if (!fd) {
+    DEBUGL << std::format("File not found: {}", fp.string()) << ENDL;
+    invalidate(path);
+    return std::nullopt;
+  }
+
+  struct stat st {};
+  if (::fstat(fd.get(), &st) != 0 || !S_ISREG(st.st_mode)) {
+    ERROR << std::format("Cannot ascertain file size for: {}", fp.string())
+          << ENDL;
+    invalidate(path);
+    return std::nullopt;
+  }
+
+  return OpenFile{std::move(fd), store(path, st)};
+}
+
+void FileCache::invalidate(std::string_view path) {
+  auto it = _entries.find(path);
+  if (it != _entries.end()) {
+    drop_response(it->second);
+    _entries.erase(it);
+  }
+}
+
+void FileCache::invalidate_all() noexcept {
+  _entries.clear();
+  _resident.clear();
+  _hand = 0;
+  _used = 0;
+}
+
+bool FileCache::watch() {
+  _watch = wnet::FileDescriptor{::inotify_init1(IN_CLOEXEC)};
+  if (!_watch) {
+    return false;
+  }
+
+  // IN_ATTRIB catches a bare mtime change (touch), which changes the ETag
+  constexpr uint32_t mask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM |
+                            IN_DELETE | IN_ATTRIB | IN_DELETE_SELF |
+                            IN_MOVE_SELF | IN_ONLYDIR;
+  if (::inotify_add_watch(_watch.get(), _root.c_str(), mask) < 0) {
+    ERROR << std::format("Cannot watch {}: {}", _root.string(),
+                         std::strerror(errno))
+          << ENDL;
+    _watch = wnet::FileDescriptor{};
+    return false;
+  }
+
+  // whatever was cached before the watch existed may already be stale
+  invalidate_all();
+  _watching = true;
+  return true;
+}
+
+void FileCache::process_events() {
+  alignas(inotify_event) char events[EVENT_BUFFER_SIZE];
+  ssize_t got = ::read(_watch.get(), events, sizeof(events));
+  if (got < 0) {
+    if (errno != EINTR && errno != EAGAIN) {
+      ERROR << std::format("Cannot read file change notifications: {}",
+                           std::strerror(errno))
+            << ENDL;
+    }
+    return;
+  }
+  apply_events({events, static_cast<std::size_t>(got)});
+}
+
+void FileCache::apply_events(std::span<const char> events) {
+  std::string path{"/"};
+  while (events.size() >= sizeof(inotify_event)) {
+    inotify_event event;
+    std::memcpy(&event, events.data(), sizeof(event)); // may be unaligned
+    const std::size_t record = sizeof(event) + event.len;
+    if (events.size() < record) {
+      break;
+    }
+
+    if (event.mask & IN_Q_OVERFLOW) { // events were dropped, trust nothing
+      WARNING << "File change notifications overflowed, dropping the cache"
+              << ENDL;
+      invalidate_all();
+    } else if (event.mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+      if (_watching) {
+        WARNING << std::format("Lost the watch on {}, revalidating every {} ms",
+                               _root.string(), _ttl.count())
+                << ENDL;
+      }
+      stop_watching();
+    } else if (event.len > 0) {
+      // the kernel pads the name with NULs
+      path.resize(1);
+      path.append(events.data() + sizeof(event),
+                  ::strnlen(events.data() + sizeof(event), event.len));
+      DEBUGL << std::format("{} changed, invalidating", path) << ENDL;
+      invalidate(path);
+    }
+
+    events = events.subspan(record);
+  }
+}
@@ -0,0 +1,162 @@
+#ifndef FILECACHE_H_
+#define FILECACHE_H_
+#include "socket.h"
+#include "stringhash.h"
+#include <chrono>
+#include <cstddef>
+#include <ctime>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <string_view>
+#include <sys/stat.h>
+#include <vector>
+
+[[nodiscard]] std::string_view get_content_type(std::string_view filename);
+
+// What a response header needs to know about a servable file.
+struct FileInfo {
+  std::size_t size{0};
+  timespec mtime{};
+  std::string_view content_type;
+};
+
+struct OpenFile {
+  wnet::FileDescriptor fd;
+  FileInfo info;
+};
+
+// A complete "200 OK" response (status line, headers, blank line and body) in
+// one immutable buffer, so a cache hit is a single send from shared memory.
+// The header in `bytes` has no Connection field; the variants that close the
+// connection or keep an HTTP/1.0 one alive are precomputed next to it, and a
+// hit that needs one sends it and then body() in the same writev.
+// Connections hold a shared_ptr while sending, which keeps the bytes alive
+// even if the entry is evicted or replaced meanwhile.
+struct CachedResponse {
+  std::string bytes;
+  std::size_t header_size{0};
+  std::string close_header;      // with "Connection: close"
+  std::string keep_alive_header; // with "Connection: keep-alive"
+  FileInfo info;
+
+  [[nodiscard]] std::string_view full() const noexcept { return bytes; }
+  [[nodiscard]] std::string_view header() const noexcept {
+    return std::string_view{bytes}.substr(0, header_size);
+  }
+  // the header carrying a Connection field with `connection` ("close",
+  // "keep-alive" or empty for none)
+  [[nodiscard]] std::string_view
+  header(std::string_view connection) const noexcept {
+    if (connection == "close") {
+      return close_header;
+    }
+    return connection.empty() ? header() : std::string_view{keep_alive_header};
+  }
+  [[nodiscard]] std::string_view body() const noexcept {
+    return std::string_view{bytes}.substr(header_size);
+  }
+  // bytes held, as counted against the cache budget
+  [[nodiscard]] std::size_t memory() const noexcept {
+    return bytes.size() + close_header.size() + keep_alive_header.size();
+  }
+};
+
+// Files under `root`, keyed by request path ("/file1.html").
+//
+// Metadata is kept for every file asked about, so a HEAD request for a hot
+// file costs no syscall and a cold one a single stat(). With watch() active
+// an entry is trusted until inotify reports a change to its file; otherwise
+// it is re-stat()ed once `ttl` has passed.
+// Files up to `max_file_size` additionally keep a precomputed full response,
+// within a total budget of `budget_bytes`; when that is exhausted resident
+// responses are evicted in CLOCK order (an entry hit since the hand last
+// passed gets a second chance).
+class FileCache {
+public:
+  using clock = std::chrono::steady_clock;
+  // the response header for a file, with a Connection field carrying the
+  // token unless it is empty
+  using HeaderBuilder = std::string (*)(const FileInfo &info,
+                                        std::string_view connection);
+
+  static constexpr std::size_t DEFAULT_BUDGET = 64 * 1024 * 1024;
+  static constexpr std::size_t DEFAULT_MAX_FILE_SIZE = 1024 * 1024;
+  // enough for a few dozen inotify events per read()
+  static constexpr std::size_t EVENT_BUFFER_SIZE = 4096;
+
+  FileCache(std::filesystem::path root, HeaderBuilder make_header,
+            std::size_t budget_bytes = DEFAULT_BUDGET,
+            std::chrono::milliseconds ttl = std::chrono::seconds(1),
+            std::size_t max_file_size = DEFAULT_MAX_FILE_SIZE);
+
+  FileCache(FileCache &&other) noexcept = default;
+  FileCache &operator=(FileCache &&other) noexcept = default;
+  FileCache(const FileCache &) = delete;
+  FileCache &operator=(const FileCache &) = delete;
+
+  // The precomputed response for `path`, read in from disk first if `load`
+  // is set and it fits. nullptr if the file is missing, too large to cache,
+  // or (without `load`) not resident; use info()/open() then.
+  [[nodiscard]] std::shared_ptr<const CachedResponse>
+  response(std::string_view path, bool load = true);
+  // nullopt if `path` is not a regular file under root
+  [[nodiscard]] std::optional<FileInfo> info(std::string_view path);
+  // opens the file for sending; fstat() of the open fd refreshes the entry
+  [[nodiscard]] std::optional<OpenFile> open(std::string_view path);
+  void invalidate(std::string_view path);
+  void invalidate_all() noexcept;
+
+  // Starts watching root for files being rewritten, renamed or deleted.
+  // false if inotify is unavailable, in which case the ttl keeps applying.
+  // watch_fd() becomes readable when notifications are pending; it is a
+  // blocking fd, so read it once per readiness event (process_events()) or
+  // hand it to io_uring and pass what was read to apply_events().
+  [[nodiscard]] bool watch();
+  [[nodiscard]] bool watching() const noexcept { return _watching; }
+  [[nodiscard]] int watch_fd() const noexcept { return _watch.get(); }
+  // entries age out through the ttl again from here on
+  void stop_watching() noexcept { _watching = false; }
+  void process_events();
+  void apply_events(std::span<const char> events);
+
+  [[nodiscard]] std::filesystem::path resolve(std::string_view path) const;
+
+  [[nodiscard]] std::size_t resident_bytes() const noexcept { return _used; }
+  [[nodiscard]] std::size_t budget() const noexcept { return _budget; }
+
+private:
+  struct Entry {
+    FileInfo info;
+    clock::time_point validated;
+    std::shared_ptr<const CachedResponse> response; // set while resident
+    bool referenced{false};                         // CLOCK reference bit
+  };
+
+  using Entries = StringMap<Entry>;
+
+  Entries::iterator revalidate(std::string_view path);
+  FileInfo &store(std::string_view path, const struct stat &st);
+  std::shared_ptr<const CachedResponse> load(std::string_view path,
+                                             Entry &entry);
+  void make_room(std::size_t bytes);
+  void drop_response(Entry &entry);
+
+  std::filesystem::path _root;
+  HeaderBuilder _make_header;
+  std::size_t _budget;
+  std::chrono::milliseconds _ttl;
+  std::size_t _max_file_size;
+
+  wnet::FileDescriptor _watch; // inotify instance
+  bool _watching{false};
+
+  Entries _entries; // node based, so Entry pointers stay valid
+  std::vector<Entry *> _resident; // entries holding a response, CLOCK ring
+  std::size_t _hand{0};
+  std::size_t _used{0}; // bytes held by resident responses
+};
+
+#endif
@@ -0,0 +1,369 @@
+#include "http.h"
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr auto npos = std::string_view::npos;
+
+// RFC 9110 tchar: the characters allowed in methods and field names
+constexpr std::array<bool, 256> TOKEN_CHARS = [] {
+  std::array<bool, 256> table{};
+  for (unsigned char c = '0'; c <= '9'; ++c)
+    table[c] = true;
+  for (unsigned char c = 'a'; c <= 'z'; ++c)
+    table[c] = table[c - 'a' + 'A'] = true;
+  for (unsigned char c : std::string_view{"!#$%&'*+-.^_`|~"})
+    table[c] = true;
+  return table;
+}();
+
+constexpr bool is_token(std::string_view s) noexcept {
+  return !s.empty() && std::ranges::all_of(s, [](unsigned char c) {
+    return TOKEN_CHARS[c];
+  });
+}
+
+// bytes that may not appear inside a header line; tab is allowed
+constexpr bool is_ctl(unsigned char c) noexcept {
+  return (c < 0x20 && c != '\t') || c == 0x7f;
+}
+
+constexpr bool is_digit(char c) noexcept { return c >= '0' && c <= '9'; }
+
+// a Content-Length value: 1*DIGIT, without sign or whitespace, that fits
+constexpr bool parse_length(std::string_view s, std::size_t &length) noexcept {
+  if (s.empty()) {
+    return false;
+  }
+  length = 0;
+  for (char c : s) {
+    const std::size_t digit = static_cast<std::size_t>(c - '0');
+    if (!is_digit(c) || length > (SIZE_MAX - digit) / 10) {
+      return false;
+    }
+    length = length * 10 + digit;
+  }
+  return true;
+}
+
+constexpr unsigned char to_lower(unsigned char c) noexcept {
+  return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+constexpr bool iequals(std::string_view a, std::string_view b) noexcept {
+  return std::ranges::equal(a, b, [](unsigned char x, unsigned char y) {
+    return to_lower(x) == to_lower(y);
+  });
+}
+
+constexpr std::string_view trim(std::string_view s) noexcept {
+  while (!s.empty() && (s.front() == ' ' || s.front() == '\t'))
+    s.remove_prefix(1);
+  while (!s.empty() && (s.back() == ' ' || s.back() == '\t'))
+    s.remove_suffix(1);
+  return s;
+}
+
+// FNV-1a over the lowercased bytes, so field names can be matched against the
+// well-known ones by comparing one integer
+constexpr uint32_t fold_hash(std::string_view s) noexcept {
+  uint32_t hash = 2166136261u;
+  for (unsigned char c : s) {
+    hash = (hash ^ to_lower(c)) * 16777619u;
+  }
+  return hash;
+}
+
+struct KnownHeader {
+  std::string_view name;
+  HeaderId id;
+  uint32_t hash;
+};
+
+constexpr KnownHeader known(std::string_view name, HeaderId id) noexcept {
+  return {name, id, fold_hash(name)};
+}
+
+constexpr std::array KNOWN_HEADERS{
+    known("host", HeaderId::Host),
+    known("connection", HeaderId::Connection),
+    known("content-length", HeaderId::ContentLength),
+    known("transfer-encoding", HeaderId::TransferEncoding),
+    known("if-none-match", HeaderId::IfNoneMatch),
+    known("if-modified-since", HeaderId::IfModifiedSince),
+    known("range", HeaderId::Range),
+    known("accept-encoding", HeaderId::AcceptEncoding),
+};
+static_assert(KNOWN_HEADERS.size() + 1 ==
+              static_cast<std::size_t>(HeaderId::Count));
+
+// Offset of the first CR, LF or other control character at or after `from`,
+// or npos. A line end and any byte that would make the line invalid are
+// found in the same pass.
+std::size_t find_stop(std::string_view data, std::size_t from) noexcept {
+  const char *p = data.data() + from;
+  const char *const end = data.data() + data.size();
+
+#ifdef __SSE2__
+  const __m128i ctl_max = _mm_set1_epi8(0x1f);
+  const __m128i del = _mm_set1_epi8(0x7f);
+  for (; end - p >= 16; p += 16) {
+    const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(p));
+    // unsigned v <= 0x1f exactly when max(v, 0x1f) == 0x1f
+    const __m128i ctl = _mm_or_si128(
+        _mm_cmpeq_epi8(_mm_max_epu8(v, ctl_max), ctl_max),
+        _mm_cmpeq_epi8(v, del));
+    for (unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(ctl));
+         mask != 0; mask &= mask - 1) {
+      const int i = __builtin_ctz(mask);
+      if (p[i] != '\t') {
+        return static_cast<std::size_t>(p + i - data.data());
+      }
+    }
+  }
+#endif
+
+  for (; p < end; ++p) {
+    if (is_ctl(static_cast<unsigned char>(*p))) {
+      return static_cast<std::size_t>(p - data.data());
+    }
+  }
+  return npos;
+}
+
+} // namespace
+
+HttpRequestType parse_method(std::string_view method) noexcept {
+  if (method == "GET")
+    return HttpRequestType::GET;
+  if (method == "HEAD")
+    return HttpRequestType::HEAD;
+  if (method == "POST")
+    return HttpRequestType::POST;
+  return HttpRequestType::INVALID;
+}
+
+HeaderId header_id(std::string_view name) noexcept {
+  const uint32_t hash = fold_hash(name);
+  for (const auto &known : KNOWN_HEADERS) {
+    if (known.hash == hash && iequals(known.name, name)) {
+      return known.id;
+    }
+  }
+  return HeaderId::Other;
+}
+
+void HeaderTable::add(const Field &field) {
+  const std::size_t index = size();
+  if (_size < INLINE_FIELDS) {
+    _inline[_size++] = field;
+  } else {
+    _overflow.push_back(field);
+  }
+
+  auto &first = _first[static_cast<std::size_t>(field.id)];
+  if (field.id != HeaderId::Other && first == 0 && index < UINT16_MAX) {
+    first = static_cast<uint16_t>(index + 1);
+  }
+}
+
+void HeaderTable::clear() noexcept {
+  _base = nullptr;
+  _size = 0;
+  _overflow.clear(); // keeps its capacity
+  _first.fill(0);
+}
+
+std::string_view HeaderTable::name(std::size_t i) const noexcept {
+  const Field &f = field(i);
+  return {_base + f.name, f.name_size};
+}
+
+std::string_view HeaderTable::value(std::size_t i) const noexcept {
+  const Field &f = field(i);
+  return {_base + f.value, f.value_size};
+}
+
+std::string_view HeaderTable::get(HeaderId id) const noexcept {
+  const auto first = _first[static_cast<std::size_t>(id)];
+  return first == 0 ? std::string_view{} : value(first - 1);
+}
+
+std::string_view HeaderTable::get(std::string_view name) const noexcept {
+  if (const auto id = header_id(name); id != HeaderId::Other) {
+    return get(id);
+  }
+  for (std::size_t i = 0; i < size(); ++i) {
+    if (iequals(this->name(i), name)) {
+      return value(i);
+    }
+  }
+  return {};
+}
+
+bool has_token(std::string_view list, std::string_view token) noexcept {
+  while (!list.empty()) {
+    const auto comma = list.find(',');
+    const auto item = trim(list.substr(0, comma));
+    list = comma == npos ? std::string_view{} : list.substr(comma + 1);
+    if (iequals(item, token)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool wants_keep_alive(const HttpRequest &request) noexcept {
+  const auto connection = request.header(HeaderId::Connection);
+  if (request.http_version == "HTTP/1.1") {
+    return !has_token(connection, "close");
+  }
+  return has_token(connection, "keep-alive");
+}
+
+bool etag_matches(std::string_view if_none_match,
+                  std::string_view etag) noexcept {
+  auto opaque = [](std::string_view tag) { // weak comparison ignores W/
+    if (tag.starts_with("W/")) {
+      tag.remove_prefix(2);
+    }
+    return tag;
+  };
+
+  etag = opaque(etag);
+  while (!if_none_match.empty()) {
+    const auto comma = if_none_match.find(',');
+    const auto item = trim(if_none_match.substr(0, comma));
+    if_none_match = comma == npos ? std::string_view{}
+                                  : if_none_match.substr(comma + 1);
+    if (item == "*" || opaque(item) == etag) {
+      return true;
+    }
+  }
+  return false;
+}
+
+RequestParser::Status RequestParser::parse(std::string_view data) {
+  while (_phase != Phase::Done) {
+    const auto stop = find_stop(data, _scan);
+    if (stop == npos || (data[stop] == '\r' && stop + 1 == data.size())) {
+      // the line (or its CRLF) is not complete yet
+      _scan = stop == npos ? data.size() : stop;
+      return data.size() >= _max_size ? Status::TooLarge : Status::Incomplete;
+    }
+
+    std::size_t next;
+    if (data[stop] == '\n') {
+      next = stop + 1; // a bare LF is tolerated as a line end
+    } else if (data[stop] == '\r' && data[stop + 1] == '\n') {
+      next = stop + 2;
+    } else {
+      return Status::Invalid; // stray control character
+    }
+    if (next > _max_size) {
+      return Status::TooLarge;
+    }
+
+    const auto line = data.substr(_pos, stop - _pos);
+    switch (_phase) {
+    case Phase::RequestLine:
+      if (line.empty()) { // empty lines before a request are ignored
+        _start = next;
+        break;
+      }
+      if (!parse_request_line(line)) {
+        return Status::Invalid;
+      }
+      _line_end = stop;
+      _phase = Phase::Fields;
+      break;
+    case Phase::Fields:
+      if (line.empty()) {
+        _phase = Phase::Done;
+      } else if (!add_field(line, _pos)) {
+        return Status::Invalid;
+      }
+      break;
+    case Phase::Done:
+      break;
+    }
+    _pos = _scan = next;
+  }
+
+  // the bytes may have moved since the request line was checked
+  (void)parse_request_line(data.substr(_start, _line_end - _start));
+  _request.headers.bind(data.data());
+  return Status::Complete;
+}
+
+bool RequestParser::parse_request_line(std::string_view line) noexcept {
+  // method SP request-target SP HTTP-version
+  const auto first = line.find(' ');
+  const auto second = line.find(' ', first + 1);
+  if (first == npos || second == npos) {
+    return false;
+  }
+
+  const auto method = line.substr(0, first);
+  const auto path = line.substr(first + 1, second - first - 1);
+  const auto version = line.substr(second + 1);
+  if (!is_token(method) || path.empty() || version.size() != 8 ||
+      !version.starts_with("HTTP/") || !is_digit(version[5]) ||
+      version[6] != '.' || !is_digit(version[7])) {
+    return false;
+  }
+
+  _request.method = parse_method(method);
+  _request.method_name = method;
+  _request.path = path;
+  _request.http_version = version;
+  return true;
+}
+
+bool RequestParser::add_field(std::string_view line, std::size_t offset) {
+  // field-name ":" OWS field-value OWS; no whitespace before the colon and
+  // no obsolete line folding
+  const auto colon = line.find(':');
+  if (colon == npos || !is_token(line.substr(0, colon))) {
+    return false;
+  }
+
+  const auto name = line.substr(0, colon);
+  const auto value = trim(line.substr(colon + 1));
+  const auto id = header_id(name);
+  if (id == HeaderId::TransferEncoding) {
+    return false; // chunked bodies are not supported
+  }
+  if (id == HeaderId::ContentLength) {
+    if (_has_length || !parse_length(value, _body_size)) {
+      return false; // repeated or malformed; the body's end is unknown
+    }
+    _has_length = true;
+  }
+
+  _request.headers.add(HeaderTable::Field{
+      .name = static_cast<uint32_t>(offset),
+      .name_size = static_cast<uint32_t>(name.size()),
+      .value = static_cast<uint32_t>(offset + (value.data() - line.data())),
+      .value_size = static_cast<uint32_t>(value.size()),
+      .id = id,
+  });
+  return true;
+}
+
+void RequestParser::reset() noexcept {
+  _phase = Phase::RequestLine;
+  _pos = _scan = _start = _line_end = 0;
+  _has_length = false;
+  _body_size = 0;
+  _request.method = HttpRequestType::INVALID;
+  _request.method_name = _request.path = _request.http_version = {};
+  _request.headers.clear(); // keeps any overflow capacity
+}
@@ -0,0 +1,167 @@
+#ifndef HTTP_H_
+#define HTTP_H_
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+enum class HttpRequestType {
+  GET,
+  HEAD,
+  POST,
+  INVALID,
+};
+
+[[nodiscard]] HttpRequestType parse_method(std::string_view method) noexcept;
+
+// Header fields the server looks at. The parser tags each field with its id
+// as it goes, so looking one up later is an array access, not a string
+// comparison.
+enum class HeaderId : uint8_t {
+  Other,
+  Host,
+  Connection,
+  ContentLength,
+  TransferEncoding,
+  IfNoneMatch,
+  IfModifiedSince,
+  Range,
+  AcceptEncoding,
+  Count, // number of ids, not a header
+};
+
+// id of a field name (case-insensitive), HeaderId::Other if not well known
+[[nodiscard]] HeaderId header_id(std::string_view name) noexcept;
+
+// Flat table of the header fields of one request. Fields are stored as
+// offsets into the request (so the parser can record them while the receive
+// buffer may still move) and read back as string_views once bound to the
+// request's final location. The first INLINE_FIELDS live in the table
+// itself; only unusually large headers touch the heap.
+class HeaderTable {
+public:
+  static constexpr std::size_t INLINE_FIELDS = 24;
+
+  struct Field {
+    uint32_t name;
+    uint32_t name_size;
+    uint32_t value;
+    uint32_t value_size;
+    HeaderId id;
+  };
+
+  void add(const Field &field);
+  void clear() noexcept;
+  void bind(const char *base) noexcept { _base = base; }
+
+  [[nodiscard]] std::size_t size() const noexcept {
+    return _size + _overflow.size();
+  }
+  [[nodiscard]] std::string_view name(std::size_t i) const noexcept;
+  [[nodiscard]] std::string_view value(std::size_t i) const noexcept;
+
+  // value of the first field with that id / name (case-insensitive); empty
+  // if there is none
+  [[nodiscard]] std::string_view get(HeaderId id) const noexcept;
+  [[nodiscard]] std::string_view get(std::string_view name) const noexcept;
+
+private:
+  [[nodiscard]] const Field &field(std::size_t i) const noexcept {
+    return i < INLINE_FIELDS ? _inline[i] : _overflow[i - INLINE_FIELDS];
+  }
+
+  const char *_base{nullptr};
+  std::array<Field, INLINE_FIELDS> _inline;
+  std::size_t _size{0}; // used entries of _inline
+  std::vector<Field> _overflow;
+  // 1 + index of the first field with each id, 0 if absent
+  std::array<uint16_t, static_cast<std::size_t>(HeaderId::Count)> _first{};
+};
+
+// A parsed request header. Every field is a view into the receive buffer the
+// request was parsed from and stays valid until those bytes are consumed.
+struct HttpRequest {
+  HttpRequestType method{HttpRequestType::INVALID};
+  std::string_view method_name;
+  std::string_view path;
+  std::string_view http_version;
+  HeaderTable headers;
+
+  [[nodiscard]] std::string_view header(HeaderId id) const noexcept {
+    return headers.get(id);
+  }
+  [[nodiscard]] std::string_view header(std::string_view name) const noexcept {
+    return headers.get(name);
+  }
+};
+
+// true if the comma separated `list` (e.g. a Connection header) contains
+// `token`, compared case-insensitively
+[[nodiscard]] bool has_token(std::string_view list,
+                             std::string_view token) noexcept;
+
+// HTTP/1.1 connections persist unless the client asks to close; HTTP/1.0
+// ones only when the client asks to keep them
+[[nodiscard]] bool wants_keep_alive(const HttpRequest &request) noexcept;
+
+// true if an If-None-Match value (`*` or a list of entity tags) matches
+// `etag`, using the weak comparison RFC 9110 prescribes for it
+[[nodiscard]] bool etag_matches(std::string_view if_none_match,
+                                std::string_view etag) noexcept;
+
+// Incremental request header parser. parse() is handed everything received so
+// far for the current request and picks up where the previous call stopped,
+// so a header trickling in over many reads is only scanned once. It does not
+// copy the request: it is located by offsets and handed out as string_views
+// into the caller's buffer, with the fields in a HeaderTable.
+//
+// Line ends are found 16 bytes at a time with SSE2 where available, which
+// also rejects control characters on the way.
+//
+// The header also frames the request: its body is Content-Length bytes (none
+// without one). Transfer-Encoding, a repeated Content-Length or one that is
+// not a plain number make the request Invalid, as its end cannot be told
+// reliably and reading on would take the body for the next request.
+class RequestParser {
+public:
+  enum class Status { Complete, Incomplete, Invalid, TooLarge };
+
+  explicit RequestParser(std::size_t max_size = 8192) noexcept
+      : _max_size(max_size) {}
+
+  // `data` must start at the first byte of the request and may move between
+  // calls (only offsets are kept). After Complete, request(), size() and
+  // body_size() are valid until reset().
+  [[nodiscard]] Status parse(std::string_view data);
+
+  [[nodiscard]] const HttpRequest &request() const noexcept { return _request; }
+  // bytes taken by the request header, blank line included
+  [[nodiscard]] std::size_t size() const noexcept { return _pos; }
+  // bytes of body that follow the header (Content-Length)
+  [[nodiscard]] std::size_t body_size() const noexcept { return _body_size; }
+
+  // get ready for the next request
+  void reset() noexcept;
+
+private:
+  enum class Phase { RequestLine, Fields, Done };
+
+  // validates the request line and points _request's fields into it
+  [[nodiscard]] bool parse_request_line(std::string_view line) noexcept;
+  // validates a field line and records it in _request.headers
+  [[nodiscard]] bool add_field(std::string_view line, std::size_t offset);
+
+  std::size_t _max_size;
+  Phase _phase{Phase::RequestLine};
+  std::size_t _pos{0};  // start of the line being parsed
+  std::size_t _scan{0}; // where scanning for its end resumes
+  // offsets of the pieces found so far; views are only bound on completion
+  std::size_t _start{0}; // request line (after any stray empty lines)
+  std::size_t _line_end{0};
+  bool _has_length{false}; // a Content-Length field was seen
+  std::size_t _body_size{0};
+  HttpRequest _request;
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include "logging.h"
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+namespace logging {
+namespace {
+
+// lines a thread can have outstanding before it starts dropping them
+constexpr std::size_t RING_CAPACITY = 1024;
+
+struct Record {
+  uint32_t size;
+  char text[RECORD_SIZE];
+};
+
+// Single producer (the owning thread), single consumer (the writer). Each
+// side only writes its own index, so pushing and draining need no lock.
+class Ring {
+public:
+  // false if full
+  bool push(const char *text, std::size_t size) noexcept {
+    const std::size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail - _head.load(std::memory_order_acquire) == RING_CAPACITY) {
+      _dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+
+    Record &record = _records[tail % RING_CAPACITY];
+    record.size = static_cast<uint32_t>(size);
+    std::memcpy(record.text, text, size);
+    _tail.store(tail + 1, std::memory_order_release);
+    return true;
+  }
+
+  // appends every pending line to `out`
+  void drain(std::string &out) {
+    const std::size_t head = _head.load(std::memory_order_relaxed);
+    const std::size_t tail = _tail.load(std::memory_order_acquire);
+    for (std::size_t i = head; i != tail; ++i) {
+      const Record &record = _records[i % RING_CAPACITY];
+      out.append(record.text, record.size);
+    }
+    _head.store(tail, std::memory_order_release);
+
+    if (const auto dropped = _dropped.exchange(0, std::memory_order_relaxed)) {
+      out += std::format("WARNING: {} log lines dropped, the writer fell "
+                         "behind\n",
+                         dropped);
+    }
+  }
+
+private:
+  alignas(64) std::atomic<std::size_t> _head{0}; // next record to write out
+  alignas(64) std::atomic<std::size_t> _tail{0}; // next record to fill
+  std::atomic<std::size_t> _dropped{0};
+  std::array<Record, RING_CAPACITY> _records;
+};
+
+// Owns every thread's ring (they outlive their threads, so nothing is lost
+// when one exits) and the thread that writes them to stderr. The writer
+// drains the rings until it finds them all empty, then sleeps until a line
+// is submitted: an idle process has no wakeups at all.
+class Backend {
+public:
+  Backend() : _writer([this] { run(); }) {}
+
+  ~Backend() {
+    _stopping.store(true);
+    _signal.fetch_add(1);
+    _signal.notify_one();
+    _writer.join();
+    write_pending(); // lines submitted while the writer was stopping
+  }
+
+  Ring &ring_for_this_thread() {
+    thread_local Ring *ring = nullptr;
+    if (ring == nullptr) { // first line from this thread
+      auto owned = std::make_unique<Ring>();
+      std::lock_guard lock{_mutex};
+      _rings.push_back(std::move(owned));
+      ring = _rings.back().get(); // only once it is owned, should that throw
+    }
+    return *ring;
+  }
+
+  // Called after every push. The fences pair up: either this sees that the
+  // writer is going to sleep, or the writer's last look at the rings sees
+  // the line. Only a sleeping writer costs a futex wake.
+  void wake() noexcept {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (_sleeping.load(std::memory_order_relaxed)) {
+      _signal.fetch_add(1, std::memory_order_relaxed);
+      _signal.notify_one();
+    }
+  }
+
+  void flush() {
+    std::lock_guard write_lock{_write_mutex};
+    write_pending_locked();
+  }
+
+private:
+  void run() {
+    while (!_stopping.load()) {
+      if (write_pending()) {
+        continue;
+      }
+      const uint32_t seen = _signal.load();
+      _sleeping.store(true, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      if (!write_pending() && !_stopping.load()) { // a line may just have come
+        _signal.wait(seen); // until wake() or ~Backend() changes it
+      }
+      _sleeping.store(false, std::memory_order_relaxed);
+    }
+  }
+
+  // true if anything was written
+  bool write_pending() {
+    std::lock_guard write_lock{_write_mutex};
+    return write_pending_locked();
+  }
+
+  bool write_pending_locked() {
+    _batch.clear();
+    {
+      std::lock_guard lock{_mutex}; // only guards the list of rings
+      for (auto &ring : _rings) {
+        ring->drain(_batch);
+      }
+    }
+
+    std::string_view rest{_batch};
+    while (!rest.empty()) {
+      const ssize_t written = ::write(STDERR_FILENO, rest.data(), rest.size());
+      if (written < 0) {
+        if (errno == EINTR) {
+          continue;
+        }
+        break; // nowhere to report it
+      }
+      rest.remove_prefix(static_cast<std::size_t>(written));
+    }
+    return !_batch.empty();
+  }
+
+  std::mutex _mutex; // _rings
+  std::vector<std::unique_ptr<Ring>> _rings;
+  std::atomic<bool> _stopping{false};
+  std::atomic<bool> _sleeping{false}; // the writer found every ring empty
+  std::atomic<uint32_t> _signal{0};   // bumped to wake the writer
+
+  std::mutex _write_mutex; // one drainer at a time (writer or flush())
+  std::string _batch;
+
+  std::thread _writer; // last, so it starts once everything above exists
+};
+
+Backend &backend() {
+  static Backend instance; // joined (and drained) at exit
+  return instance;
+}
+
+} // namespace
+
+void submit(const char *text, std::size_t size) noexcept {
+  try {
+    Backend &b = backend();
+    Ring &ring = b.ring_for_this_thread();
+    ring.push(text, size);
+    b.wake();
+  } catch (const std::exception &) {
+    // no memory for the ring, or no writer thread: nowhere to put the line
+  }
+}
+
+void flush() noexcept {
+  try {
+    backend().flush();
+  } catch (const std::exception &) {
+    // nowhere to report it
+  }
+}
+
+} // namespace logging
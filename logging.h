@@ -9,35 +9,137 @@
 #ifndef LOGGING_H
 #define LOGGING_H
 
+#include <algorithm>
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <cstring>
 #include <filesystem>
-#include <iostream>
+#include <sstream>
 #include <string>
+#include <string_view>
 
 #ifndef __FILE_NAME__
 #define __FILE_NAME__ std::filesystem::path(__FILE__).filename().string()
 #endif
 
 inline int LOG_LEVEL = 3;
-#define TRACE                                                                  \
-  if (LOG_LEVEL > 5) {                                                         \
-  std::cerr << "TRACE: "
-#define DEBUGL                                                                 \
-  if (LOG_LEVEL > 4) {                                                         \
-  std::cerr << "DEBUG: "
-#define INFO                                                                   \
-  if (LOG_LEVEL > 3) {                                                         \
-  std::cerr << "INFO: "
-#define WARNING                                                                \
-  if (LOG_LEVEL > 2) {                                                         \
-  std::cerr << "WARNING: "
-#define ERROR                                                                  \
-  if (LOG_LEVEL > 1) {                                                         \
-  std::cerr << "ERROR: "
-#define FATAL                                                                  \
-  if (LOG_LEVEL > 0) {                                                         \
-  std::cerr << "FATAL: "
+
+namespace logging {
+
+// Longest log line kept, newline included; longer lines are cut short.
+inline constexpr std::size_t RECORD_SIZE = 256;
+
+// Hands a finished line to the backend: it is copied into the calling
+// thread's ring buffer and written to stderr by a background thread, which
+// batches whatever has accumulated into one write(2). The calling thread
+// never blocks or takes a lock; if its ring is full the line is dropped and
+// counted. A thread's ring is allocated with its first line, which is
+// dropped if that fails. Lines from one thread stay in order.
+// Not async-signal-safe: do not log from signal handlers.
+void submit(const char *text, std::size_t size) noexcept;
+
+// Writes out everything submitted so far (called at exit automatically).
+void flush() noexcept;
+
+// The character types, which are integral but print as characters (or, for
+// the wide ones, not at all), as with std::ostream.
+template <typename T>
+concept character =
+    std::same_as<T, char> || std::same_as<T, signed char> ||
+    std::same_as<T, unsigned char> || std::same_as<T, wchar_t> ||
+    std::same_as<T, char8_t> || std::same_as<T, char16_t> ||
+    std::same_as<T, char32_t>;
+
+// What Line formats with std::to_chars.
+template <typename T>
+concept number = (std::integral<T> && !std::same_as<T, bool> &&
+                  !character<T>) ||
+                 std::floating_point<T>;
+
+// One log line, formatted on the stack and submitted when the statement
+// ends.
+class Line {
+public:
+  Line() noexcept = default;
+  Line(const Line &) = delete;
+  Line &operator=(const Line &) = delete;
+  ~Line() {
+    _text[_size++] = '\n'; // room is always kept for it
+    submit(_text, _size);
+  }
+
+  Line &operator<<(std::string_view s) noexcept {
+    const std::size_t n = std::min(s.size(), ROOM - _size);
+    std::memcpy(_text + _size, s.data(), n);
+    _size += n;
+    return *this;
+  }
+  Line &operator<<(const char *s) noexcept {
+    return *this << std::string_view{s};
+  }
+  Line &operator<<(const std::string &s) noexcept {
+    return *this << std::string_view{s};
+  }
+  Line &operator<<(char c) noexcept { return *this << std::string_view{&c, 1}; }
+  // int8_t and uint8_t too, so these print as characters, like std::ostream
+  Line &operator<<(signed char c) noexcept {
+    return *this << static_cast<char>(c);
+  }
+  Line &operator<<(unsigned char c) noexcept {
+    return *this << static_cast<char>(c);
+  }
+  // 1 or 0, like std::ostream without std::boolalpha
+  Line &operator<<(bool b) noexcept { return *this << (b ? '1' : '0'); }
+
+  template <number T> Line &operator<<(T value) noexcept {
+    auto [end, ec] = std::to_chars(_text + _size, _text + ROOM, value);
+    if (ec == std::errc{}) {
+      _size = static_cast<std::size_t>(end - _text);
+    }
+    return *this;
+  }
+
+  // anything else that can be streamed, the slow way
+  template <typename T>
+    requires(!std::integral<T> && !std::floating_point<T> &&
+             !std::convertible_to<const T &, std::string_view>)
+  Line &operator<<(const T &value) {
+    std::ostringstream out;
+    out << value;
+    return *this << std::string_view{out.str()};
+  }
+
+private:
+  static constexpr std::size_t ROOM = RECORD_SIZE - 1; // minus the newline
+
+  char _text[RECORD_SIZE];
+  std::size_t _size{0};
+};
+
+} // namespace logging
+
+// Most verbose level compiled in, on the LOG_LEVEL scale (6 = TRACE, 3 =
+// WARNING). Statements above it are discarded at compile time, message
+// arguments and all, instead of being tested against LOG_LEVEL at run time;
+// -d only chooses among the levels that remain. `make release` sets it to 3.
+#ifndef LOG_COMPILED_LEVEL
+#define LOG_COMPILED_LEVEL 6
+#endif
+
+#define LOG_AT(level, prefix)                                                  \
+  if constexpr (LOG_COMPILED_LEVEL > (level))                                  \
+    if (LOG_LEVEL > (level)) {                                                 \
+  ::logging::Line{} << prefix
+
+#define TRACE LOG_AT(5, "TRACE: ")
+#define DEBUGL LOG_AT(4, "DEBUG: ")
+#define INFO LOG_AT(3, "INFO: ")
+#define WARNING LOG_AT(2, "WARNING: ")
+#define ERROR LOG_AT(1, "ERROR: ")
+#define FATAL LOG_AT(0, "FATAL: ")
 #define ENDL                                                                   \
-  " (" << __FILE_NAME__ << ":" << __LINE__ << ")" << std::endl;                \
+  " (" << __FILE_NAME__ << ":" << __LINE__ << ")";                             \
   }
 
 #endif // LOGGING_H
@@ -0,0 +1,239 @@
+#include "metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace metrics {
+namespace {
+
+constexpr std::array<std::string_view, Shard::METHODS> METHOD_NAMES{
+    "GET", "HEAD", "POST", "other"};
+static_assert(static_cast<std::size_t>(HttpRequestType::GET) == 0 &&
+              static_cast<std::size_t>(HttpRequestType::HEAD) == 1 &&
+              static_cast<std::size_t>(HttpRequestType::POST) == 2);
+
+// the buckets tile the range: exact below 32, then each bucket starts right
+// after the previous one ends
+using H = LatencyHistogram;
+static_assert(H::bucket(31) == 31 && H::bucket(32) == 32 &&
+              H::upper_bound(32) == 33 &&
+              H::bucket(H::upper_bound(100) + 1) == 101 &&
+              H::bucket(~uint64_t{0}) == H::BUCKETS - 1);
+
+class Registry {
+public:
+  Shard &add() {
+    std::lock_guard lock{_mutex};
+    return *_shards.emplace_back(std::make_unique<Shard>());
+  }
+
+  // calls f(shard) for every shard
+  template <typename F> void for_each(F &&f) const {
+    std::lock_guard lock{_mutex}; // only guards the list, not the values
+    for (const auto &shard : _shards) {
+      f(*shard);
+    }
+  }
+
+private:
+  mutable std::mutex _mutex;
+  std::vector<std::unique_ptr<Shard>> _shards;
+};
+
+Registry &registry() {
+  static Registry instance;
+  return instance;
+}
+
+std::size_t status_index(uint16_t status) noexcept {
+  return static_cast<std::size_t>(
+      std::ranges::find(STATUSES, status) - STATUSES.begin());
+}
+
+template <typename... Args>
+void append(std::string &out, std::format_string<Args...> fmt,
+            Args &&...args) {
+  std::format_to(std::back_inserter(out), fmt, std::forward<Args>(args)...);
+}
+
+void describe(std::string &out, std::string_view name, std::string_view type,
+              std::string_view help) {
+  append(out, "# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+}
+
+// every shard's histograms for each phase, summed
+std::array<LatencySnapshot, static_cast<std::size_t>(Phase::Count)>
+phase_snapshots() {
+  std::array<LatencySnapshot, static_cast<std::size_t>(Phase::Count)> phases;
+  registry().for_each([&](const Shard &shard) {
+    for (std::size_t p = 0; p < phases.size(); ++p) {
+      phases[p].add(shard.phases[p]);
+    }
+  });
+  return phases;
+}
+
+double seconds(uint64_t ns) noexcept { return static_cast<double>(ns) / 1e9; }
+
+} // namespace
+
+void LatencySnapshot::add(const LatencyHistogram &h) noexcept {
+  for (std::size_t i = 0; i < _counts.size(); ++i) {
+    const uint64_t n = h._counts[i].get();
+    _counts[i] += n;
+    _count += n;
+  }
+  _sum_ns += h._sum_ns.get();
+}
+
+uint64_t LatencySnapshot::quantile_ns(double q) const noexcept {
+  if (_count == 0) {
+    return 0;
+  }
+  // the rank of the value wanted, 1-based
+  const auto rank = std::max<uint64_t>(
+      1, static_cast<uint64_t>(std::ceil(q * static_cast<double>(_count))));
+  uint64_t seen = 0;
+  for (std::size_t i = 0; i < _counts.size(); ++i) {
+    seen += _counts[i];
+    if (seen >= rank) {
+      return LatencyHistogram::upper_bound(i);
+    }
+  }
+  return LatencyHistogram::upper_bound(_counts.size() - 1);
+}
+
+void Shard::count_request(HttpRequestType method, uint16_t status,
+                          uint64_t bytes, clock::duration latency) noexcept {
+  const auto m = std::min(static_cast<std::size_t>(method), METHODS - 1);
+  requests[m][status_index(status)].add();
+  response_bytes.add(bytes);
+
+  const auto us = static_cast<uint64_t>(
+      std::chrono::duration_cast<std::chrono::microseconds>(latency).count());
+  const auto bucket = static_cast<std::size_t>(
+      std::ranges::lower_bound(LATENCY_BOUNDS_US, us) -
+      LATENCY_BOUNDS_US.begin());
+  latency_buckets[bucket].add();
+  latency_sum_us.add(us);
+}
+
+Shard &local() {
+  thread_local Shard *shard = &registry().add();
+  return *shard;
+}
+
+std::string render() {
+  // the shards summed; Counters are not copyable, so plain integers
+  std::array<std::array<uint64_t, STATUSES.size() + 1>, Shard::METHODS>
+      requests{};
+  std::array<uint64_t, LATENCY_BOUNDS_US.size() + 1> buckets{};
+  uint64_t bytes = 0, hits = 0, misses = 0, accepted = 0, latency_sum = 0;
+  int64_t active = 0, queued = 0;
+
+  registry().for_each([&](const Shard &shard) {
+    for (std::size_t m = 0; m < requests.size(); ++m) {
+      for (std::size_t s = 0; s < requests[m].size(); ++s) {
+        requests[m][s] += shard.requests[m][s].get();
+      }
+    }
+    for (std::size_t b = 0; b < buckets.size(); ++b) {
+      buckets[b] += shard.latency_buckets[b].get();
+    }
+    bytes += shard.response_bytes.get();
+    hits += shard.cache_hits.get();
+    misses += shard.cache_misses.get();
+    accepted += shard.connections_accepted.get();
+    latency_sum += shard.latency_sum_us.get();
+    active += shard.active_connections.get();
+    queued += shard.accept_queue.get();
+  });
+
+  std::string out;
+  describe(out, "webserver_requests_total", "counter",
+           "Responses sent, by request method and status.");
+  for (std::size_t m = 0; m < requests.size(); ++m) {
+    for (std::size_t s = 0; s < requests[m].size(); ++s) {
+      const std::string status =
+          s < STATUSES.size() ? std::to_string(STATUSES[s]) : "other";
+      append(out,
+             "webserver_requests_total{{method=\"{}\",status=\"{}\"}} {}\n",
+             METHOD_NAMES[m], status, requests[m][s]);
+    }
+  }
+
+  describe(out, "webserver_response_bytes_total", "counter",
+           "Response bytes handed to the kernel.");
+  append(out, "webserver_response_bytes_total {}\n", bytes);
+  describe(out, "webserver_cache_hits_total", "counter",
+           "Files served from a precomputed response.");
+  append(out, "webserver_cache_hits_total {}\n", hits);
+  describe(out, "webserver_cache_misses_total", "counter",
+           "Files that had to be opened or stat()ed.");
+  append(out, "webserver_cache_misses_total {}\n", misses);
+  describe(out, "webserver_connections_accepted_total", "counter",
+           "Client connections accepted.");
+  append(out, "webserver_connections_accepted_total {}\n", accepted);
+  describe(out, "webserver_active_connections", "gauge",
+           "Client connections currently open.");
+  append(out, "webserver_active_connections {}\n", active);
+  describe(out, "webserver_accept_queue_depth", "gauge",
+           "Connections waiting in the listen backlogs at the last sample.");
+  append(out, "webserver_accept_queue_depth {}\n", queued);
+
+  describe(out, "webserver_request_duration_seconds", "histogram",
+           "Time from the first byte of a request to the last of its "
+           "response.");
+  uint64_t cumulative = 0;
+  for (std::size_t b = 0; b < LATENCY_BOUNDS_US.size(); ++b) {
+    cumulative += buckets[b];
+    append(out, "webserver_request_duration_seconds_bucket{{le=\"{}\"}} {}\n",
+           static_cast<double>(LATENCY_BOUNDS_US[b]) / 1e6, cumulative);
+  }
+  cumulative += buckets.back();
+  append(out, "webserver_request_duration_seconds_bucket{{le=\"+Inf\"}} {}\n",
+         cumulative);
+  append(out, "webserver_request_duration_seconds_sum {}\n",
+         static_cast<double>(latency_sum) / 1e6);
+  append(out, "webserver_request_duration_seconds_count {}\n", cumulative);
+
+  describe(out, "webserver_phase_seconds", "summary",
+           "Time spent in each phase of a request (log-linear histograms, "
+           "within 6.25%).");
+  const auto phases = phase_snapshots();
+  for (std::size_t p = 0; p < phases.size(); ++p) {
+    for (double q : QUANTILES) {
+      append(out,
+             "webserver_phase_seconds{{phase=\"{}\",quantile=\"{}\"}} {}\n",
+             PHASE_NAMES[p], q, seconds(phases[p].quantile_ns(q)));
+    }
+    append(out, "webserver_phase_seconds_sum{{phase=\"{}\"}} {}\n",
+           PHASE_NAMES[p], seconds(phases[p].sum_ns()));
+    append(out, "webserver_phase_seconds_count{{phase=\"{}\"}} {}\n",
+           PHASE_NAMES[p], phases[p].count());
+  }
+  return out;
+}
+
+std::string latency_report() {
+  std::string out = "Request phase latency (microseconds):\n";
+  append(out, "  {:<8} {:>10} {:>10} {:>10} {:>10}\n", "phase", "count",
+         "p50", "p99", "p99.9");
+  const auto phases = phase_snapshots();
+  for (std::size_t p = 0; p < phases.size(); ++p) {
+    const auto us = [&](double q) {
+      return static_cast<double>(phases[p].quantile_ns(q)) / 1e3;
+    };
+    append(out, "  {:<8} {:>10} {:>10.1f} {:>10.1f} {:>10.1f}\n",
+           PHASE_NAMES[p], phases[p].count(), us(0.5), us(0.99), us(0.999));
+  }
+  return out;
+}
+
+} // namespace metrics
@@ -0,0 +1,188 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+#include "http.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// **************************************************************************************
+// * Metrics
+// * -- counters, gauges and latency histograms, sharded per thread: each
+// *    thread updates only its own Shard (found through a thread_local, so
+// *    the request path takes no lock and shares no cache line with other
+// *    workers), and render() sums the shards when /metrics is scraped.
+// *    Updates are relaxed atomic adds, so a scrape from another thread reads
+// *    consistent (if slightly stale) values.
+// **************************************************************************************
+namespace metrics {
+
+using clock = std::chrono::steady_clock;
+
+// request_duration_seconds bucket bounds (le), in microseconds
+inline constexpr std::array<uint64_t, 14> LATENCY_BOUNDS_US{
+    100,    250,    500,     1000,    2500,    5000,    10000,
+    25000,  50000,  100000,  250000,  500000,  1000000, 2500000};
+
+// the statuses this server sends, plus one for anything else
+inline constexpr std::array<uint16_t, 4> STATUSES{200, 304, 400, 404};
+
+class Counter {
+public:
+  void add(uint64_t n = 1) noexcept {
+    _value.fetch_add(n, std::memory_order_relaxed);
+  }
+  [[nodiscard]] uint64_t get() const noexcept {
+    return _value.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<uint64_t> _value{0};
+};
+
+class Gauge {
+public:
+  void add(int64_t n) noexcept {
+    _value.fetch_add(n, std::memory_order_relaxed);
+  }
+  void set(int64_t n) noexcept { _value.store(n, std::memory_order_relaxed); }
+  [[nodiscard]] int64_t get() const noexcept {
+    return _value.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::atomic<int64_t> _value{0};
+};
+
+// Log-linear (HDR style) histogram of durations in nanoseconds: every power
+// of two is split into 2^SUB_BITS equal buckets, so any value is known to
+// within 1/16 (6.25%) from a few KB of counters, whatever its magnitude.
+// Recording is a bit scan, a shift and one add.
+class LatencyHistogram {
+public:
+  static constexpr unsigned SUB_BITS = 4;
+  static constexpr unsigned MAX_BITS = 40; // about 18 minutes; longer clamps
+  static constexpr std::size_t BUCKETS = (MAX_BITS - SUB_BITS + 1)
+                                         << SUB_BITS;
+
+  static constexpr std::size_t bucket(uint64_t ns) noexcept {
+    ns = ns < (uint64_t{1} << MAX_BITS) ? ns : (uint64_t{1} << MAX_BITS) - 1;
+    if (ns < (uint64_t{1} << SUB_BITS)) {
+      return static_cast<std::size_t>(ns);
+    }
+    const unsigned shift = static_cast<unsigned>(std::bit_width(ns)) - 1 -
+                           SUB_BITS; // keeps the top SUB_BITS + 1 bits
+    return ((shift + 1) << SUB_BITS) +
+           static_cast<std::size_t>((ns >> shift) - (uint64_t{1} << SUB_BITS));
+  }
+
+  // the largest value that lands in `index`
+  static constexpr uint64_t upper_bound(std::size_t index) noexcept {
+    const std::size_t block = index >> SUB_BITS;
+    if (block == 0) {
+      return index;
+    }
+    const unsigned shift = static_cast<unsigned>(block) - 1;
+    const uint64_t lowest = ((uint64_t{1} << SUB_BITS) +
+                             (index & ((std::size_t{1} << SUB_BITS) - 1)))
+                            << shift;
+    return lowest + (uint64_t{1} << shift) - 1;
+  }
+
+  void record(clock::duration d) noexcept {
+    const auto ns = static_cast<uint64_t>(std::max<int64_t>(
+        0, std::chrono::duration_cast<std::chrono::nanoseconds>(d).count()));
+    _counts[bucket(ns)].add();
+    _sum_ns.add(ns);
+  }
+
+private:
+  friend class LatencySnapshot;
+
+  std::array<Counter, BUCKETS> _counts;
+  Counter _sum_ns;
+};
+
+// Several LatencyHistograms (one phase of every shard) summed, for
+// reporting quantiles.
+class LatencySnapshot {
+public:
+  void add(const LatencyHistogram &h) noexcept;
+
+  [[nodiscard]] uint64_t count() const noexcept { return _count; }
+  [[nodiscard]] uint64_t sum_ns() const noexcept { return _sum_ns; }
+  // the smallest bucket bound that at least fraction q of the values are
+  // at or below (q in [0, 1]); 0 when empty
+  [[nodiscard]] uint64_t quantile_ns(double q) const noexcept;
+
+private:
+  std::array<uint64_t, LatencyHistogram::BUCKETS> _counts{};
+  uint64_t _count{0};
+  uint64_t _sum_ns{0};
+};
+
+// The stages of a request, each timed from the end of the previous one.
+enum class Phase : uint8_t {
+  Connect, // accept to the first byte (a connection's first request only)
+  Parse,   // first byte to complete header; a pipelined request also waits
+           // here while the batch before it is sent
+  Route,   // header to a decision on what to send
+  Handle,  // that decision to a queued response (file lookup, headers)
+  Send,    // queued to the last byte handed to the kernel
+  Total,   // first byte to last byte
+  Count
+};
+
+inline constexpr std::array<std::string_view,
+                            static_cast<std::size_t>(Phase::Count)>
+    PHASE_NAMES{"connect", "parse", "route", "handle", "send", "total"};
+
+// the quantiles reported for every phase
+inline constexpr std::array<double, 3> QUANTILES{0.5, 0.99, 0.999};
+
+// One thread's metrics. Aligned so that neighbouring shards never share a
+// cache line.
+struct alignas(64) Shard {
+  static constexpr std::size_t METHODS =
+      static_cast<std::size_t>(HttpRequestType::INVALID) + 1;
+
+  // by method and status (STATUSES index, or STATUSES.size() for others)
+  std::array<std::array<Counter, STATUSES.size() + 1>, METHODS> requests;
+  Counter response_bytes;
+  Counter cache_hits;   // answered from a precomputed response
+  Counter cache_misses; // file opened or stat()ed instead
+  Counter connections_accepted;
+  Gauge active_connections;
+  Gauge accept_queue; // connections waiting in this worker's listen backlog
+
+  // request latency, first byte to last byte sent; the last bucket is +Inf
+  std::array<Counter, LATENCY_BOUNDS_US.size() + 1> latency_buckets;
+  Counter latency_sum_us;
+
+  std::array<LatencyHistogram, static_cast<std::size_t>(Phase::Count)> phases;
+
+  void count_request(HttpRequestType method, uint16_t status, uint64_t bytes,
+                     clock::duration latency) noexcept;
+  void time_phase(Phase phase, clock::duration d) noexcept {
+    phases[static_cast<std::size_t>(phase)].record(d);
+  }
+};
+
+// The calling thread's shard, registered on first use. Shards outlive their
+// threads, so nothing counted is lost when a worker exits.
+[[nodiscard]] Shard &local();
+
+// Every shard summed, in the Prometheus text exposition format.
+[[nodiscard]] std::string render();
+
+// Count, p50, p99 and p99.9 of every phase, one line each, for people.
+[[nodiscard]] std::string latency_report();
+
+} // namespace metrics
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef ROUTES_H_
+#define ROUTES_H_
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// A fixed set of request paths, looked up through a perfect hash that is
+// found at compile time: the seed is searched until every path lands in its
+// own slot, so a lookup is one hash of the path, one slot load and at most
+// one string comparison, with no allocation.
+template <std::size_t N> class RouteTable {
+public:
+  static_assert(N > 0 && N < UINT8_MAX);
+  // a power of two at least twice the number of paths, so a seed is found
+  // quickly and the slot is a mask away from the hash
+  static constexpr std::size_t SLOTS = [] {
+    std::size_t slots = 1;
+    while (slots < 2 * N) {
+      slots *= 2;
+    }
+    return slots;
+  }();
+
+  consteval explicit RouteTable(const std::array<std::string_view, N> &paths)
+      : _paths(paths) {
+    for (_seed = 1;; ++_seed) {
+      if (place()) {
+        return;
+      }
+    }
+  }
+
+  // index of `path` in the set the table was built from, or -1
+  [[nodiscard]] constexpr int find(std::string_view path) const noexcept {
+    const uint8_t slot = _slots[hash(path, _seed) & (SLOTS - 1)];
+    return slot != 0 && _paths[slot - 1] == path ? slot - 1 : -1;
+  }
+
+  [[nodiscard]] constexpr bool contains(std::string_view path) const noexcept {
+    return find(path) >= 0;
+  }
+
+  [[nodiscard]] constexpr std::size_t size() const noexcept { return N; }
+
+private:
+  // FNV-1a with the seed folded into the offset basis
+  static constexpr uint32_t hash(std::string_view s, uint32_t seed) noexcept {
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (unsigned char c : s) {
+      h = (h ^ c) * 16777619u;
+    }
+    return h ^ (h >> 15);
+  }
+
+  // fills _slots for the current seed; false on a collision
+  constexpr bool place() noexcept {
+    _slots = {};
+    for (std::size_t i = 0; i < N; ++i) {
+      auto &slot = _slots[hash(_paths[i], _seed) & (SLOTS - 1)];
+      if (slot != 0) {
+        return false;
+      }
+      slot = static_cast<uint8_t>(i + 1);
+    }
+    return true;
+  }
+
+  std::array<std::string_view, N> _paths;
+  std::array<uint8_t, SLOTS> _slots{}; // 1 + index into _paths, 0 if empty
+  uint32_t _seed{0};
+};
+
+// the files the server hands out: /file[0-9].html and /image[0-9].jpg
+inline constexpr RouteTable SERVABLE_PATHS{std::to_array<std::string_view>({
+    "/file0.html",  "/file1.html",  "/file2.html",  "/file3.html",
+    "/file4.html",  "/file5.html",  "/file6.html",  "/file7.html",
+    "/file8.html",  "/file9.html",  "/image0.jpg",  "/image1.jpg",
+    "/image2.jpg",  "/image3.jpg",  "/image4.jpg",  "/image5.jpg",
+    "/image6.jpg",  "/image7.jpg",  "/image8.jpg",  "/image9.jpg",
+})};
+
+#endif
@@ -1,17 +1,28 @@
 #include "socket.h"
+#include <algorithm>
+#include <array>
 #include <arpa/inet.h>
 #include <cerrno>
+#include <climits>
 #include <cstddef>
 #include <cstring>
+#include <fcntl.h>
 #include <format>
 #include <memory>
 #include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <optional>
 #include <span>
 #include <stdexcept>
 #include <sys/socket.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
+#include <sys/time.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <system_error>
+#include <type_traits>
 #include <unistd.h>
 
 namespace wnet {
@@ -43,316 +54,529 @@ constexpr void FileDescriptor::reset(int fd) {
   _fd = fd;
 }
 
-struct SocketAddr::Impl {
-  sockaddr_in addr{};
+SocketAddr::SocketAddr() noexcept { _storage.ss_family = AF_INET; }
 
-  Impl() {
-    std::memset(&addr, 0, sizeof(addr));
-    addr.sin_family = AF_INET; // ipv4
-  }
-};
-
-SocketAddr::SocketAddr() noexcept
-    : _impl(std::make_unique<SocketAddr::Impl>()) {}
-
-SocketAddr::SocketAddr(std::string_view ip, uint16_t port)
-    : _impl(std::make_unique<SocketAddr::Impl>()) {
-  _impl->addr.sin_port =
-      htons(port); // must convert endianess to network endianess
-  if (inet_pton(AF_INET, ip.data(), &_impl->addr.sin_addr) != 1) {
+SocketAddr::SocketAddr(std::string_view ip, uint16_t port) {
+  const std::string address{ip}; // inet_pton() wants it NUL terminated
+  auto *v4 = reinterpret_cast<sockaddr_in *>(&_storage);
+  auto *v6 = reinterpret_cast<sockaddr_in6 *>(&_storage);
+  if (inet_pton(AF_INET, address.c_str(), &v4->sin_addr) == 1) {
+    v4->sin_family = AF_INET;
+    v4->sin_port = htons(port); // must convert endianess to network endianess
+  } else if (inet_pton(AF_INET6, address.c_str(), &v6->sin6_addr) == 1) {
+    v6->sin6_family = AF_INET6;
+    v6->sin6_port = htons(port);
+  } else {
     throw std::invalid_argument(
-        std::format("Invalid IPv4 address supplied: {}", ip));
+        std::format("Invalid IP address supplied: {}", ip));
   }
 }
 
-SocketAddr::SocketAddr(const SocketAddr &other)
-    : _impl(other._impl ? std::make_unique<Impl>(*other._impl) : nullptr) {}
-
-SocketAddr::SocketAddr(SocketAddr &&other) noexcept
-    : _impl(std::move(other._impl)) {}
-
-SocketAddr &SocketAddr::operator=(const SocketAddr &other) {
-  if (this != &other) {
-    if (other._impl) {
-      _impl = std::make_unique<Impl>(*other._impl);
-    } else {
-      _impl.reset();
-    }
-  }
-  return *this;
+SocketAddr::SocketAddr(const sockaddr *addr, socklen_t length) noexcept {
+  std::memcpy(&_storage, addr,
+              std::min<std::size_t>(length, sizeof(_storage)));
 }
 
-SocketAddr &SocketAddr::operator=(SocketAddr &&other) noexcept {
-  if (this != &other) {
-    _impl = std::move(other._impl);
-  }
-
-  return *this;
-}
-
-SocketAddr::~SocketAddr() noexcept {}
-
-const sockaddr *SocketAddr::asCType() const noexcept {
-  return reinterpret_cast<const sockaddr *>(&_impl->addr);
-}
-
-sockaddr *SocketAddr::asCType() noexcept {
-  return reinterpret_cast<sockaddr *>(&_impl->addr);
+socklen_t SocketAddr::size() const noexcept {
+  return is_v6() ? sizeof(sockaddr_in6) : sizeof(sockaddr_in);
 }
 
-std::size_t SocketAddr::size() const noexcept { return sizeof(_impl->addr); }
-
 uint16_t SocketAddr::port() const noexcept {
-  return ntohs(_impl->addr.sin_port); // convert to host endianess
+  // sin_port and sin6_port are at the same offset
+  const auto *v4 = reinterpret_cast<const sockaddr_in *>(&_storage);
+  return ntohs(v4->sin_port); // convert to host endianess
 }
 
 std::string SocketAddr::ip() const {
-  std::array<char, INET_ADDRSTRLEN> buf;
-  if (inet_ntop(AF_INET, &_impl->addr.sin_addr, buf.data(), sizeof(buf)) ==
-      NULL) {
-    // EAFNOSUPPORT cannot happen because AF_INET is always supported
-    throw new std::length_error(
-        std::format("Buffer is too small (something is really wrong because "
-                    "INET_ADDRSTRLEN is incorrect). INET_ADDRSTRLEN: {}",
-                    INET_ADDRSTRLEN));
+  std::array<char, INET6_ADDRSTRLEN> buf{};
+  const void *addr =
+      is_v6() ? static_cast<const void *>(
+                    &reinterpret_cast<const sockaddr_in6 *>(&_storage)
+                         ->sin6_addr)
+              : &reinterpret_cast<const sockaddr_in *>(&_storage)->sin_addr;
+  if (inet_ntop(family(), addr, buf.data(), buf.size()) == NULL) {
+    // only an unknown family can fail, the buffer fits any address
+    return {};
   }
-  return std::string(buf.data(), buf.size());
+  return std::string(buf.data());
 }
 
 uint32_t SocketAddr::ipValue() const noexcept {
-  return ntohl(_impl->addr.sin_addr.s_addr);
+  if (!is_v6()) {
+    const auto *v4 = reinterpret_cast<const sockaddr_in *>(&_storage);
+    return ntohl(v4->sin_addr.s_addr);
+  }
+  const auto &addr =
+      reinterpret_cast<const sockaddr_in6 *>(&_storage)->sin6_addr;
+  if (!IN6_IS_ADDR_V4MAPPED(&addr)) {
+    return 0;
+  }
+  uint32_t value;
+  std::memcpy(&value, addr.s6_addr + 12, sizeof(value));
+  return ntohl(value);
 }
 
 bool SocketAddr::operator==(const SocketAddr &other) const noexcept {
-  return _impl->addr.sin_family == other._impl->addr.sin_family &&
-         _impl->addr.sin_port == _impl->addr.sin_port &&
-         _impl->addr.sin_addr.s_addr == other._impl->addr.sin_addr.s_addr;
+  if (family() != other.family() || port() != other.port()) {
+    return false;
+  }
+  if (!is_v6()) {
+    return ipValue() == other.ipValue();
+  }
+  const auto *a = reinterpret_cast<const sockaddr_in6 *>(&_storage);
+  const auto *b = reinterpret_cast<const sockaddr_in6 *>(&other._storage);
+  return std::memcmp(&a->sin6_addr, &b->sin6_addr, sizeof(a->sin6_addr)) == 0 &&
+         a->sin6_scope_id == b->sin6_scope_id;
+}
+
+std::size_t SocketAddr::hash() const noexcept {
+  // FNV-1a over exactly the bytes operator== compares
+  uint64_t hash = 14695981039346656037ull;
+  auto mix = [&hash](const void *data, std::size_t size) {
+    for (std::size_t i = 0; i < size; ++i) {
+      hash = (hash ^ static_cast<const unsigned char *>(data)[i]) *
+             1099511628211ull;
+    }
+  };
+
+  const uint16_t port = this->port();
+  const auto family = static_cast<uint16_t>(this->family());
+  mix(&family, sizeof(family));
+  mix(&port, sizeof(port));
+  if (!is_v6()) {
+    const uint32_t ip = ipValue();
+    mix(&ip, sizeof(ip));
+  } else {
+    const auto *v6 = reinterpret_cast<const sockaddr_in6 *>(&_storage);
+    mix(&v6->sin6_addr, sizeof(v6->sin6_addr));
+    mix(&v6->sin6_scope_id, sizeof(v6->sin6_scope_id));
+  }
+  return static_cast<std::size_t>(hash);
 }
 
 std::string SocketAddr::to_string() const {
-  return std::format("{}:{}", ip(), port());
-}
-
-struct Socket::Impl {
-  FileDescriptor fd;
-  Type type{Type::TCP};
-  State state; // TODO: figure out starting state, probably closed or
-               // uninitialized
-  mutable error_code last_error;
-
-  explicit Impl(Type t) : type(t) {}
-  [[nodiscard]] bool setOption(int level, int option_name,
-                               const void *option_value,
-                               socklen_t option_length) {
-    if (setsockopt(fd.get(), level, option_name, option_value, option_length) !=
-        0) { // error occured if not zero
-      last_error = std::error_code(errno, std::system_category());
-      return false;
-    }
-    return true;
-  }
+  return is_v6() ? std::format("[{}]:{}", ip(), port())
+                 : std::format("{}:{}", ip(), port());
+}
 
-  template <typename T>
-  [[nodiscard]] bool setOption(int level, int option_name, const T &value) {
-    return setOption(level, option_name, &value, sizeof(value));
-  }
-};
+static_assert(std::is_trivially_copyable_v<SocketAddr>);
 
-Socket::Socket(Socket::Type type) : _impl(std::make_unique<Impl>(type)) {
-  int fd = socket(AF_INET, SOCK_STREAM, 0); // only TCP supported for now
+static_assert(sizeof(Socket) <= 8);
+
+Socket::Socket(Socket::Type type, int family)
+    : _type(type), _family(static_cast<sa_family_t>(family)) {
+  int fd = socket(family, SOCK_STREAM, 0); // only TCP supported for now
   if (fd < 0) {
-    if (_impl->last_error.has_value()) {
-      _impl->last_error = std::error_code(errno, std::system_category());
-      throw std::runtime_error(std::format("Unable to create socket: {}",
-                                           _impl->last_error.value().what()));
-    } else {
-      throw std::runtime_error(
-          "Unable to create socket: no error message given");
-    }
+    throw std::system_error(errno, std::system_category(),
+                            "Unable to create socket");
   }
 
-  _impl->fd.reset(fd);
+  _fd = FileDescriptor{fd};
 }
 
-Socket::~Socket() noexcept {
-  if (_impl && _impl->fd.is_valid()) {
-    ::close(_impl->fd.get());
+Socket::Socket(FileDescriptor fd, Type type, State state, int family) noexcept
+    : _fd(std::move(fd)), _type(type), _state(state),
+      _family(static_cast<sa_family_t>(family)) {}
+
+Socket::Socket(Socket &&other) noexcept = default;
+Socket &Socket::operator=(Socket &&other) noexcept = default;
+Socket::~Socket() noexcept = default; // FileDescriptor closes the fd
+
+bool Socket::set_option(int level, int option_name, const void *option_value,
+                        socklen_t option_length) const noexcept {
+  if (setsockopt(_fd.get(), level, option_name, option_value, option_length) !=
+      0) { // error occured if not zero, errno tells why
+    return false;
   }
+  return true;
 }
 
-std::optional<Socket> Socket::create(Socket::Type type) {
-  try {
-    return std::optional<Socket>{type};
-  } catch (...) {
-    return std::nullopt;
+Result<Socket> Socket::create(Socket::Type type, int family) {
+  int fd = ::socket(family, SOCK_STREAM, 0); // only TCP supported for now
+  if (fd < 0) {
+    return errno_error();
   }
+  return Socket{FileDescriptor{fd}, type, State::Create, family};
 }
 
-std::optional<Socket> Socket::create_bind(const SocketAddr &addr,
-                                          Socket::Type type) {
-  auto s = create(type);
+Socket Socket::adopt(int fd, State state, Type type, int family) noexcept {
+  return Socket{FileDescriptor{fd}, type, state, family};
+}
+
+Result<Socket> Socket::create_bind(const SocketAddr &addr, Socket::Type type) {
+  auto s = create(type, addr.family());
   if (!s)
-    return std::nullopt;
-  if (!s->bind(addr))
-    return std::nullopt;
+    return s;
+  if (auto bound = s->bind(addr); !bound)
+    return std::unexpected{bound.error()};
 
   return s;
 }
 
-bool Socket::bind(const SocketAddr &addr) {
-  if (::bind(_impl->fd.get(), addr.asCType(), addr.size()) != 0) {
-    _impl->last_error = std::error_code(errno, std::system_category());
-    return false;
+Result<void> Socket::set_options(const SocketOptions &options) {
+  const auto failed = [] { return errno_error(); };
+  const auto to_timeval = [](std::chrono::milliseconds ms) {
+    timeval tv{};
+    tv.tv_sec = static_cast<time_t>(ms.count() / 1000);
+    tv.tv_usec = static_cast<suseconds_t>((ms.count() % 1000) * 1000);
+    return tv;
+  };
+
+  const int reuse_addr = options.reuse_addr ? 1 : 0;
+  if (!set_option(SOL_SOCKET, SO_REUSEADDR, reuse_addr))
+    return failed();
+
+  if (_family == AF_INET6) {
+    const int v6_only = options.v6_only ? 1 : 0;
+    if (!set_option(IPPROTO_IPV6, IPV6_V6ONLY, v6_only))
+      return failed();
   }
-  _impl->state = State::Bind;
-  return true;
+
+  const int reuse_port = options.reuse_port ? 1 : 0;
+  if (!set_option(SOL_SOCKET, SO_REUSEPORT, reuse_port))
+    return failed();
+
+  const int keep_alive = options.keep_alive ? 1 : 0;
+  if (!set_option(SOL_SOCKET, SO_KEEPALIVE, keep_alive))
+    return failed();
+
+  if (_type == Type::TCP) {
+    const int no_delay = options.no_delay ? 1 : 0;
+    if (!set_option(IPPROTO_TCP, TCP_NODELAY, no_delay))
+      return failed();
+  }
+
+  if (options.send_timeout &&
+      !set_option(SOL_SOCKET, SO_SNDTIMEO, to_timeval(*options.send_timeout)))
+    return failed();
+
+  if (options.recv_timeout &&
+      !set_option(SOL_SOCKET, SO_RCVTIMEO, to_timeval(*options.recv_timeout)))
+    return failed();
+
+  if (options.send_buffer_size &&
+      !set_option(SOL_SOCKET, SO_SNDBUF, *options.send_buffer_size))
+    return failed();
+
+  if (options.recv_buffer_size &&
+      !set_option(SOL_SOCKET, SO_RCVBUF, *options.recv_buffer_size))
+    return failed();
+
+  if (_type == Type::TCP) {
+#ifdef TCP_DEFER_ACCEPT
+    if (options.defer_accept &&
+        !set_option(IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                    static_cast<int>(options.defer_accept->count())))
+      return failed();
+#else
+    if (options.defer_accept)
+      return std::unexpected{std::errc::not_supported};
+#endif
+
+#ifdef TCP_FASTOPEN
+    if (options.fast_open &&
+        !set_option(IPPROTO_TCP, TCP_FASTOPEN, *options.fast_open))
+      return failed();
+#else
+    if (options.fast_open)
+      return std::unexpected{std::errc::not_supported};
+#endif
+
+    if (options.quick_ack)
+      if (auto result = set_quick_ack(true); !result)
+        return result;
+
+#ifdef TCP_NOTSENT_LOWAT
+    if (options.notsent_lowat &&
+        !set_option(IPPROTO_TCP, TCP_NOTSENT_LOWAT, *options.notsent_lowat))
+      return failed();
+#else
+    if (options.notsent_lowat)
+      return std::unexpected{std::errc::not_supported};
+#endif
+  }
+
+#ifdef SO_BUSY_POLL
+  if (options.busy_poll &&
+      !set_option(SOL_SOCKET, SO_BUSY_POLL,
+                  static_cast<int>(options.busy_poll->count())))
+    return failed();
+#else
+  if (options.busy_poll)
+    return std::unexpected{std::errc::not_supported};
+#endif
+
+  return set_blocking(options.blocking);
+}
+
+Result<void> Socket::set_quick_ack(bool quick_ack) {
+#ifdef TCP_QUICKACK
+  if (!set_option(IPPROTO_TCP, TCP_QUICKACK, quick_ack ? 1 : 0))
+    return errno_error();
+  return {};
+#else
+  if (quick_ack)
+    return std::unexpected{std::errc::not_supported};
+  return {};
+#endif
+}
+
+Result<void> Socket::set_blocking(bool blocking) {
+  int flags = ::fcntl(_fd.get(), F_GETFL, 0);
+  if (flags < 0) {
+    return errno_error();
+  }
+
+  flags = blocking ? (flags & ~O_NONBLOCK) : (flags | O_NONBLOCK);
+  if (::fcntl(_fd.get(), F_SETFL, flags) != 0) {
+    return errno_error();
+  }
+
+  return {};
 }
 
-bool Socket::listen(int backlog) {
-  if (_impl->type != Type::TCP) { // connection must be TCP
-    _impl->last_error = std::error_code(EOPNOTSUPP, std::system_category());
-    return false;
+Result<void> Socket::bind(const SocketAddr &addr) {
+  if (::bind(_fd.get(), addr.asCType(), addr.size()) != 0) {
+    return errno_error();
+  }
+  _state = State::Bind;
+  return {};
+}
+
+Result<void> Socket::listen(int backlog) {
+  if (_type != Type::TCP) { // connection must be TCP
+    return std::unexpected{std::errc::operation_not_supported};
   }
 
-  if (::listen(_impl->fd.get(), backlog) != 0) {
-    _impl->last_error = std::error_code(errno, std::system_category());
-    return false;
+  if (::listen(_fd.get(), backlog) != 0) {
+    return errno_error();
   }
 
-  _impl->state = State::Listen;
-  return true; // success
+  _state = State::Listen;
+  return {}; // success
 }
 
-std::optional<std::pair<Socket, SocketAddr>> Socket::accept() {
-  if (_impl->state != State::Listen) {
-    _impl->last_error = std::error_code(EINVAL, std::system_category());
-    return std::nullopt;
+Result<std::pair<Socket, SocketAddr>> Socket::accept(bool blocking) {
+  if (_state != State::Listen) {
+    return std::unexpected{std::errc::invalid_argument};
   }
 
-  sockaddr_in client_addr{};
+  sockaddr_storage client_addr{};
   socklen_t client_len = sizeof(client_addr);
 
-  int cfd = ::accept(_impl->fd.get(),
-                     reinterpret_cast<sockaddr *>(&client_addr), &client_len);
+#ifdef __linux__
+  const int flags = SOCK_CLOEXEC | (blocking ? 0 : SOCK_NONBLOCK);
+  int cfd = ::accept4(_fd.get(), reinterpret_cast<sockaddr *>(&client_addr),
+                      &client_len, flags);
+#else
+  int cfd = ::accept(_fd.get(), reinterpret_cast<sockaddr *>(&client_addr),
+                     &client_len);
+#endif
 
   if (cfd < 0) {
-    _impl->last_error = std::error_code(errno, std::system_category());
-    return std::nullopt;
+    return errno_error();
   }
 
-  Socket client(_impl->type);
-  client._impl->fd.reset(cfd);
-  client._impl->state = State::Connect;
-
-  SocketAddr addr;
-  addr._impl->addr = client_addr;
+  // adopt() wraps the fd as is; constructing a Socket would open another one
+  Socket client = adopt(cfd, State::Connect, _type, _family);
+#ifndef __linux__
+  ::fcntl(cfd, F_SETFD, FD_CLOEXEC);
+  if (!blocking) {
+    if (auto result = client.set_blocking(false); !result)
+      return std::unexpected{result.error()};
+  }
+#endif
 
-  auto pair =
-      std::make_pair<Socket, SocketAddr>(std::move(client), std::move(addr));
-  return pair;
+  SocketAddr addr{reinterpret_cast<const sockaddr *>(&client_addr),
+                  client_len};
+  return std::make_pair(std::move(client), addr);
 }
 
-bool Socket::connect(const SocketAddr &addr) {
-  int result = ::connect(_impl->fd.get(), addr.asCType(), addr.size());
+Result<void> Socket::connect(const SocketAddr &addr) {
+  int result = ::connect(_fd.get(), addr.asCType(), addr.size());
 
   if (result < 0) {
-    _impl->last_error = std::error_code(errno, std::system_category());
-    return false;
+    return errno_error();
   }
 
-  _impl->state = State::Connect;
-  return true;
+  _state = State::Connect;
+  return {};
 }
 
-std::optional<std::size_t> Socket::send(std::span<const std::byte> data) {
+Result<std::size_t> Socket::send(std::span<const std::byte> data) {
   ssize_t sent =
-      ::send(_impl->fd.get(), data.data(), data.size(), MSG_NOSIGNAL);
+      ::send(_fd.get(), data.data(), data.size(), MSG_NOSIGNAL);
   if (sent < 0) {
-    _impl->last_error = std::error_code(errno, std::system_category());
-    return std::nullopt;
+    return errno_error();
   }
 
   return static_cast<std::size_t>(sent);
 }
 
-std::optional<std::size_t> Socket::send(std::string_view data) {
+Result<std::size_t> Socket::send(std::string_view data) {
   return send(
       std::span{reinterpret_cast<const std::byte *>(data.data()), data.size()});
 }
 
-std::optional<std::size_t> Socket::recv(std::span<std::byte> buffer) {
-  ssize_t received = ::recv(_impl->fd.get(), buffer.data(), buffer.size(), 0);
+Result<std::size_t> Socket::sendv(std::span<iovec> &iov, bool more) {
+  msghdr msg{};
+  msg.msg_iov = iov.data();
+  msg.msg_iovlen = std::min<std::size_t>(iov.size(), IOV_MAX);
+
+  int flags = MSG_NOSIGNAL;
+#ifdef MSG_MORE
+  if (more) {
+    flags |= MSG_MORE;
+  }
+#endif
+
+  ssize_t sent = ::sendmsg(_fd.get(), &msg, flags);
+  if (sent < 0) {
+    return errno_error();
+  }
+
+  auto left = static_cast<std::size_t>(sent);
+  while (!iov.empty() && left >= iov.front().iov_len) {
+    left -= iov.front().iov_len;
+    iov = iov.subspan(1);
+  }
+  if (left > 0) {
+    iov.front().iov_base = static_cast<char *>(iov.front().iov_base) + left;
+    iov.front().iov_len -= left;
+  }
+
+  return static_cast<std::size_t>(sent);
+}
+
+Result<std::size_t> Socket::send_file(int file_fd, off_t offset,
+                                             std::size_t length) {
+#ifdef __linux__
+  off_t file_offset = offset;
+  ssize_t sent = ::sendfile(_fd.get(), file_fd, &file_offset, length);
+  if (sent >= 0) {
+    return static_cast<std::size_t>(sent);
+  }
+  if (errno != EINVAL && errno != ENOSYS) {
+    return errno_error();
+  }
+
+  // sendfile() refused this file (e.g. some FUSE/proc files): move the data
+  // with splice() through a pipe instead, still without a user space copy.
+  int pipe_fds[2];
+  if (::pipe2(pipe_fds, O_CLOEXEC | O_NONBLOCK) != 0) {
+    return errno_error();
+  }
+  FileDescriptor pipe_read{pipe_fds[0]};
+  FileDescriptor pipe_write{pipe_fds[1]};
+
+  loff_t in_offset = offset;
+  ssize_t in_pipe = ::splice(file_fd, &in_offset, pipe_write.get(), nullptr,
+                             length, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+  if (in_pipe <= 0) {
+    if (in_pipe < 0) {
+      return errno_error();
+    }
+    return 0; // end of file
+  }
+
+  // Whatever the socket does not take now is dropped with the pipe; the
+  // caller retries from offset + returned bytes, so nothing is lost.
+  std::size_t moved = 0;
+  while (moved < static_cast<std::size_t>(in_pipe)) {
+    ssize_t out = ::splice(pipe_read.get(), nullptr, _fd.get(), nullptr,
+                           in_pipe - moved, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+    if (out < 0) {
+      if (moved > 0)
+        break;
+      return errno_error();
+    }
+    moved += static_cast<std::size_t>(out);
+  }
+  return moved;
+#else
+  std::array<std::byte, 16384> buf;
+  ssize_t got = ::pread(file_fd, buf.data(), std::min(length, buf.size()),
+                        offset);
+  if (got < 0) {
+    return errno_error();
+  }
+  return send(std::span{buf.data(), static_cast<std::size_t>(got)});
+#endif
+}
+
+Result<std::size_t> Socket::recv(std::span<std::byte> buffer) {
+  ssize_t received = ::recv(_fd.get(), buffer.data(), buffer.size(), 0);
   if (received < 0) {
-    _impl->last_error = std::error_code(errno, std::system_category());
-    return std::nullopt;
+    return errno_error();
   }
 
   return static_cast<std::size_t>(received);
 }
 
-std::optional<std::size_t> Socket::recv(std::span<char> buf) {
+Result<std::size_t> Socket::recv(std::span<char> buf) {
   return Socket::recv(std::as_writable_bytes(buf));
 }
 
-std::optional<std::string> Socket::recv_string(std::size_t max_length) {
+Result<std::string> Socket::recv_string(std::size_t max_length) {
   std::string buf(max_length, '\0');
-  ssize_t received = ::recv(_impl->fd.get(), buf.data(), max_length, 0);
+  ssize_t received = ::recv(_fd.get(), buf.data(), max_length, 0);
   if (received < 0) {
-    _impl->last_error = std::error_code(errno, std::system_category());
-    return std::nullopt;
+    return errno_error();
   }
 
   buf.resize(received);
   return buf;
 }
 
-std::optional<std::string> Socket::recv_line(std::size_t max_length) {
+Result<std::string> Socket::recv_line(std::size_t max_length) {
+  return recv_until("\n", max_length);
+}
+
+// Peeks at whatever is queued, then consumes exactly up to the end of the
+// delimiter (or everything peeked if it is not there yet), so bytes after the
+// delimiter are left in the socket for the next call. Two syscalls per chunk
+// instead of one per byte.
+[[nodiscard]] Result<std::string>
+Socket::recv_until(std::string_view delim, std::size_t max_length) {
+  if (delim.empty()) {
+    return recv_string(max_length);
+  }
+
+  constexpr std::size_t peek_chunk = 1024;
   std::string result;
-  result.reserve(max_length);
 
-  for (std::size_t i = 0; i < max_length; ++i) {
-    char cur;
-    ssize_t received = ::recv(_impl->fd.get(), &cur, 1, 0);
-    if (received < 0) {
-      _impl->last_error = std::error_code(errno, std::system_category());
-      return std::nullopt;
-    }
+  while (result.size() < max_length) {
+    const std::size_t old_size = result.size();
+    const std::size_t want = std::min(peek_chunk, max_length - old_size);
+    result.resize(old_size + want);
 
-    if (received == 0) { // no more bytes sent
-      break;
+    ssize_t peeked =
+        ::recv(_fd.get(), result.data() + old_size, want, MSG_PEEK);
+    if (peeked < 0) {
+      return errno_error();
     }
 
-    result += cur;
-
-    if (cur == '\n') {
+    if (peeked == 0) { // no more bytes sent
+      result.resize(old_size);
       break;
     }
-  }
 
-  return result;
-}
-
-[[nodiscard]] std::optional<std::string>
-Socket::recv_until(std::string_view delim, std::size_t max_length) {
-  std::string result;
-  result.reserve(max_length);
+    // the delimiter may have started in the previous chunk
+    const std::size_t search_from =
+        old_size >= delim.size() - 1 ? old_size - (delim.size() - 1) : 0;
+    const auto pos = std::string_view{result.data(), old_size + peeked}.find(
+        delim, search_from);
+    const std::size_t take = pos == std::string_view::npos
+                                 ? static_cast<std::size_t>(peeked)
+                                 : pos + delim.size() - old_size;
 
-  for (std::size_t i = 0; i < max_length; ++i) {
-    char cur;
-    ssize_t received = ::recv(_impl->fd.get(), &cur, 1, 0);
+    ssize_t received = ::recv(_fd.get(), result.data() + old_size, take, 0);
     if (received < 0) {
-      _impl->last_error = std::error_code(errno, std::system_category());
-      return std::nullopt;
+      return errno_error();
     }
+    result.resize(old_size + static_cast<std::size_t>(received));
 
-    if (received == 0) { // no more bytes sent
-      break;
-    }
-
-    result += cur;
-
-    if (result.size() >= delim.size() &&
-        result.substr(result.size() - delim.size()) == delim) {
+    if (pos != std::string_view::npos) {
       break;
     }
   }
@@ -360,34 +584,72 @@ Socket::recv_until(std::string_view delim, std::size_t max_length) {
   return result;
 }
 
-std::optional<std::pair<std::size_t, SocketAddr>>
+Result<std::pair<std::size_t, SocketAddr>>
 Socket::recv_from(std::span<std::byte> buf) {
   SocketAddr fromaddr;
-  socklen_t fromsize = fromaddr.size();
+  socklen_t fromsize = SocketAddr::capacity();
 
-  ssize_t received = ::recvfrom(_impl->fd.get(), buf.data(), buf.size(), 0,
+  ssize_t received = ::recvfrom(_fd.get(), buf.data(), buf.size(), 0,
                                 fromaddr.asCType(), &fromsize);
 
   if (received < 0) {
-    _impl->last_error = std::error_code(errno, std::system_category());
-    return std::nullopt;
+    return errno_error();
   }
 
-  SocketAddr addr(fromaddr);
-  return std::make_pair(static_cast<std::size_t>(received), std::move(addr));
+  return std::make_pair(static_cast<std::size_t>(received), fromaddr);
 }
 
 void Socket::close() noexcept {
-  if (_impl && _impl->fd.is_valid()) {
-    ::close(_impl->fd.get());
-    _impl->fd.reset(-1);
-    _impl->state = State::Close;
+  if (_fd.is_valid()) {
+    _fd.reset(-1); // closes the old fd exactly once
+    _state = State::Close;
   }
 }
 
-std::error_code Socket::shutdown(bool read, bool write) {
-  if (!_impl || !_impl->fd.is_valid()) {
-    return std::error_code(EBADF, std::system_category());
+Result<SocketAddr> Socket::local_addr() const {
+  SocketAddr addr;
+  socklen_t len = SocketAddr::capacity();
+  if (::getsockname(_fd.get(), addr.asCType(), &len) != 0) {
+    return errno_error();
+  }
+  return addr;
+}
+
+Result<SocketAddr> Socket::remote_addr() const {
+  SocketAddr addr;
+  socklen_t len = SocketAddr::capacity();
+  if (::getpeername(_fd.get(), addr.asCType(), &len) != 0) {
+    return errno_error();
+  }
+  return addr;
+}
+
+Result<uint32_t> Socket::accept_queue_length() const {
+#ifdef TCP_INFO
+  tcp_info info{};
+  socklen_t len = sizeof(info);
+  if (::getsockopt(_fd.get(), IPPROTO_TCP, TCP_INFO, &info, &len) != 0) {
+    return errno_error();
+  }
+  return info.tcpi_unacked; // for a listener, the current accept backlog
+#else
+  return std::unexpected{std::errc::not_supported};
+#endif
+}
+
+bool Socket::isValid() const noexcept { return _fd.is_valid(); }
+
+int Socket::fd() const noexcept { return _fd.get(); }
+
+Socket::State Socket::state() const noexcept { return _state; }
+
+Socket::Type Socket::type() const noexcept { return _type; }
+
+int Socket::family() const noexcept { return _family; }
+
+Result<void> Socket::shutdown(bool read, bool write) {
+  if (!_fd.is_valid()) {
+    return std::unexpected{std::errc::bad_file_descriptor};
   }
 
   int how = 0;
@@ -398,14 +660,187 @@ std::error_code Socket::shutdown(bool read, bool write) {
   } else if (write) {
     how = SHUT_WR;
   } else {
-    return std::error_code(EINVAL, std::system_category());
+    return std::unexpected{std::errc::invalid_argument};
   }
 
-  if (::shutdown(_impl->fd.get(), how) != 0) {
-    return std::error_code(errno, std::system_category());
+  if (::shutdown(_fd.get(), how) != 0) {
+    return errno_error();
   }
 
-  return std::error_code{};
+  return {};
+}
+
+#ifdef __linux__
+namespace {
+uint32_t to_epoll(short events, Poll::Trigger trigger) noexcept {
+  uint32_t ev = 0;
+  if (events & POLLIN)
+    ev |= EPOLLIN;
+  if (events & POLLOUT)
+    ev |= EPOLLOUT;
+  if (events & POLLPRI)
+    ev |= EPOLLPRI;
+  if (trigger == Poll::Trigger::Edge)
+    ev |= EPOLLET;
+  return ev; // EPOLLERR and EPOLLHUP are always reported
+}
+
+short from_epoll(uint32_t ev) noexcept {
+  short events = 0;
+  if (ev & EPOLLIN)
+    events |= POLLIN;
+  if (ev & EPOLLOUT)
+    events |= POLLOUT;
+  if (ev & EPOLLPRI)
+    events |= POLLPRI;
+  if (ev & EPOLLERR)
+    events |= POLLERR;
+  if (ev & (EPOLLHUP | EPOLLRDHUP))
+    events |= POLLHUP;
+  return events;
+}
+
+void epoll_control(int epoll_fd, int op, int fd, uint32_t events) {
+  epoll_event ev{};
+  ev.events = events;
+  ev.data.fd = fd;
+  if (::epoll_ctl(epoll_fd, op, fd, &ev) != 0) {
+    throw std::system_error(errno, std::system_category(),
+                            std::format("epoll_ctl failed for fd {}", fd));
+  }
+}
+} // namespace
+#endif
+
+Poll::Poll(Backend backend, Trigger trigger)
+    : _backend(backend), _trigger(trigger) {
+#ifdef __linux__
+  if (_backend == Backend::Epoll) {
+    int efd = ::epoll_create1(EPOLL_CLOEXEC);
+    if (efd < 0) {
+      throw std::system_error(errno, std::system_category(),
+                              "Unable to create epoll instance");
+    }
+    _epoll_fd.reset(efd);
+    _epoll_events.resize(64);
+  }
+#else
+  _backend = Backend::Poll;
+#endif
+}
+
+void Poll::add(int fd, short events, Callback callback) {
+  if (contains(fd)) { // re-registering just replaces interest and callback
+    modify(fd, events);
+    _callbacks[fd] = std::move(callback);
+    return;
+  }
+
+#ifdef __linux__
+  if (_backend == Backend::Epoll) {
+    epoll_control(_epoll_fd.get(), EPOLL_CTL_ADD, fd,
+                  to_epoll(events, _trigger));
+    _callbacks.emplace(fd, std::move(callback));
+    return;
+  }
+#endif
+
+  _index.emplace(fd, _fds.size());
+  _fds.push_back(pollfd{.fd = fd, .events = events, .revents = 0});
+  _callbacks.emplace(fd, std::move(callback));
+}
+
+void Poll::modify(int fd, short events) {
+#ifdef __linux__
+  if (_backend == Backend::Epoll) {
+    if (contains(fd)) {
+      epoll_control(_epoll_fd.get(), EPOLL_CTL_MOD, fd,
+                    to_epoll(events, _trigger));
+    }
+    return;
+  }
+#endif
+
+  auto it = _index.find(fd);
+  if (it != _index.end()) {
+    _fds[it->second].events = events;
+  }
+}
+
+void Poll::remove(int fd) {
+  if (_callbacks.erase(fd) == 0) {
+    return;
+  }
+
+#ifdef __linux__
+  if (_backend == Backend::Epoll) {
+    // may fail if the fd was already closed, which also deregisters it
+    ::epoll_ctl(_epoll_fd.get(), EPOLL_CTL_DEL, fd, nullptr);
+    return;
+  }
+#endif
+
+  auto it = _index.find(fd);
+  const std::size_t pos = it->second;
+  _index.erase(it);
+  if (pos != _fds.size() - 1) { // order of _fds does not matter: swap and pop
+    _fds[pos] = _fds.back();
+    _index[_fds[pos].fd] = pos;
+  }
+  _fds.pop_back();
+}
+
+bool Poll::contains(int fd) const noexcept { return _callbacks.contains(fd); }
+
+int Poll::poll(std::chrono::milliseconds timeout) {
+  _pending_events.clear();
+
+#ifdef __linux__
+  if (_backend == Backend::Epoll) {
+    int ready = ::epoll_wait(_epoll_fd.get(), _epoll_events.data(),
+                             static_cast<int>(_epoll_events.size()),
+                             static_cast<int>(timeout.count()));
+    if (ready <= 0) {
+      return ready;
+    }
+
+    for (int i = 0; i < ready; ++i) {
+      const int fd = _epoll_events[i].data.fd; // epoll_event is packed
+      _pending_events.emplace_back(fd, from_epoll(_epoll_events[i].events));
+    }
+
+    if (static_cast<std::size_t>(ready) == _epoll_events.size()) {
+      _epoll_events.resize(_epoll_events.size() * 2); // more may be waiting
+    }
+    return ready;
+  }
+#endif
+
+  int ready = ::poll(_fds.data(), _fds.size(), static_cast<int>(timeout.count()));
+  if (ready <= 0) {
+    return ready; // timeout, or error with errno set (EINTR on signals)
+  }
+
+  for (const auto &p : _fds) {
+    if (p.revents != 0) {
+      _pending_events.emplace_back(p.fd, p.revents);
+    }
+  }
+
+  return ready;
+}
+
+void Poll::process_events() {
+  for (const auto &[fd, revents] : _pending_events) {
+    auto it = _callbacks.find(fd);
+    if (it == _callbacks.end()) {
+      continue; // removed by an earlier callback in this batch
+    }
+    // copy, since the callback may remove (and so destroy) its own entry
+    auto callback = it->second;
+    callback(fd, revents);
+  }
+  _pending_events.clear();
 }
 
 } // namespace wnet
@@ -1,10 +1,12 @@
 #ifndef SOCKET_H_
 #define SOCKET_H_
+#include <cerrno>
 #include <chrono>
 #include <concepts>
 #include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <expected>
 #include <functional>
 #include <memory>
 #include <netinet/in.h>
@@ -18,6 +20,12 @@
 #include <string_view>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#else
+struct epoll_event; // only used by Poll::Backend::Epoll
+#endif
 #include <system_error>
 #include <unistd.h>
 #include <unordered_map>
@@ -29,7 +37,29 @@
 // struct pollfd;
 
 namespace wnet { // wrapper for network utilities
-using error_code = std::optional<std::system_error>;
+
+// Outcome of a call that can fail: the value, or the errno it failed with as
+// a std::errc. Failing is as cheap as succeeding (no std::system_error or
+// message string is built), so a non-blocking socket that is merely not
+// ready costs one compare on the hot path; see would_block().
+template <typename T> using Result = std::expected<T, std::errc>;
+
+// true for the error of a non-blocking call that only failed because the
+// socket was not ready (EAGAIN/EWOULDBLOCK)
+[[nodiscard]] constexpr bool would_block(std::errc error) noexcept {
+  return error == std::errc::resource_unavailable_try_again ||
+         error == std::errc::operation_would_block;
+}
+
+// the current errno as the error of a Result
+[[nodiscard]] inline std::unexpected<std::errc> errno_error() noexcept {
+  return std::unexpected{static_cast<std::errc>(errno)};
+}
+
+// human readable text for logging an error
+[[nodiscard]] inline std::string error_message(std::errc error) {
+  return std::make_error_code(error).message();
+}
 
 class SocketAddr;
 class Socket;
@@ -74,43 +104,58 @@ private:
   int _fd{-1};
 };
 
+// An IPv4 or IPv6 address and port, held inline in a sockaddr_storage: a
+// trivially copyable value that never allocates, usable as a hash key.
 class SocketAddr {
 public:
   static inline const std::string LOCALHOST = "127.0.0.1";
+  static inline const std::string LOCALHOST6 = "::1";
+  // IPv6 wildcard; a listener bound to it also takes IPv4 clients unless
+  // SocketOptions::v6_only is set
+  static inline const std::string ANY6 = "::";
 
-  SocketAddr() noexcept;
+  SocketAddr() noexcept; // 0.0.0.0:0
+  // `ip` is a numeric IPv4 or IPv6 address; throws std::invalid_argument
   SocketAddr(std::string_view ip, uint16_t port);
+  // copies `length` bytes of a sockaddr filled in by the kernel
+  SocketAddr(const sockaddr *addr, socklen_t length) noexcept;
 
-  SocketAddr(const SocketAddr &other);
-  SocketAddr(SocketAddr &&other) noexcept;
-
-  SocketAddr &operator=(const SocketAddr &other);
-  SocketAddr &operator=(SocketAddr &&other) noexcept;
-
-  ~SocketAddr() noexcept;
+  [[nodiscard]] const sockaddr *asCType() const noexcept {
+    return reinterpret_cast<const sockaddr *>(&_storage);
+  }
+  [[nodiscard]] sockaddr *asCType() noexcept {
+    return reinterpret_cast<sockaddr *>(&_storage);
+  }
+  // length of the sockaddr for this family, as bind() and connect() want it
+  [[nodiscard]] socklen_t size() const noexcept;
+  // room for any address, as accept() and getsockname() want it
+  [[nodiscard]] static constexpr socklen_t capacity() noexcept {
+    return sizeof(sockaddr_storage);
+  }
 
-  [[nodiscard]] const sockaddr *asCType() const noexcept;
-  [[nodiscard]] sockaddr *asCType() noexcept;
-  [[nodiscard]] std::size_t size() const noexcept;
+  [[nodiscard]] int family() const noexcept { return _storage.ss_family; }
+  [[nodiscard]] bool is_v6() const noexcept { return family() == AF_INET6; }
 
   [[nodiscard]] uint16_t port() const noexcept;
   [[nodiscard]] std::string ip() const;
+  // IPv4 address in host byte order (IPv4-mapped IPv6 addresses included),
+  // 0 for other IPv6 addresses
   [[nodiscard]] uint32_t ipValue() const noexcept;
 
   [[nodiscard]] bool operator==(const SocketAddr &otherAddr) const noexcept;
-  [[nodiscard]] bool
-  operator<=>(const SocketAddr &otherAddr) const noexcept = default;
+  [[nodiscard]] std::size_t hash() const noexcept;
 
+  // "1.2.3.4:80" or "[::1]:80"
   [[nodiscard]] std::string to_string() const;
 
 private:
-  struct Impl; // the underlying socket from libc
-  std::unique_ptr<Impl> _impl;
-  friend class Socket;
+  sockaddr_storage _storage{};
 };
 
 struct SocketOptions {
   bool reuse_addr = true;
+  // IPV6_V6ONLY, for IPv6 sockets only: false makes a listener dual-stack
+  bool v6_only = false;
   bool reuse_port = false;
   bool keep_alive = false;
   bool no_delay = false;
@@ -119,88 +164,176 @@ struct SocketOptions {
   std::optional<std::chrono::milliseconds> recv_timeout;
   std::optional<int> send_buffer_size;
   std::optional<int> recv_buffer_size;
+
+  // Linux TCP tuning; left at the kernel defaults unless set. All but
+  // quick_ack are inherited by sockets accepted from a listener that has them.
+  // TCP_DEFER_ACCEPT: accept() only once the client has sent data (or the
+  // timeout passed), so a new connection arrives with its request
+  std::optional<std::chrono::seconds> defer_accept;
+  // TCP_FASTOPEN: length of the queue of not yet accepted TFO connections;
+  // lets a returning client send its request in the SYN
+  std::optional<int> fast_open;
+  // TCP_QUICKACK: ACK right away instead of delaying. The kernel may switch
+  // back to delayed ACKs on its own, so this is a hint for the connection
+  // start; set it on accepted sockets with set_quick_ack()
+  bool quick_ack = false;
+  // SO_BUSY_POLL: spin on the device queue for up to this long on a blocking
+  // read instead of sleeping (needs CAP_NET_ADMIN to raise)
+  std::optional<std::chrono::microseconds> busy_poll;
+  // TCP_NOTSENT_LOWAT: report writable only while less than this many bytes
+  // are queued but unsent, which keeps the send buffer from bloating
+  std::optional<int> notsent_lowat;
 };
 
+// An owned socket fd with its type and state, held inline (8 bytes, no
+// allocation), so connections can be stored by value in contiguous tables.
+// Calls that can fail return a Result.
 class Socket {
 public:
-  enum class Type {
+  enum class Type : uint8_t {
     TCP,
     UDP, // TODO: add udp support (not needed for this lab)
   };
 
-  enum class State { Create, Listen, Bind, Recv, Accept, Connect, Close };
+  enum class State : uint8_t {
+    Create,
+    Listen,
+    Bind,
+    Recv,
+    Accept,
+    Connect,
+    Close
+  };
 
-  explicit Socket(Type type = Type::TCP);
-  Socket(Socket &&other) noexcept = default;
-  Socket &operator=(Socket &&other) noexcept = default;
+  // `family` is AF_INET or AF_INET6
+  explicit Socket(Type type = Type::TCP, int family = AF_INET);
+  Socket(Socket &&other) noexcept;
+  Socket &operator=(Socket &&other) noexcept;
   ~Socket() noexcept;
 
   Socket(const Socket &) = delete;
   Socket &operator=(const Socket &) = delete;
 
-  [[nodiscard]] static std::optional<Socket> create(Type type = Type::TCP);
-  [[nodiscard]] static std::optional<Socket> create_bind(const SocketAddr &addr,
-                                                         Type type = Type::TCP);
-  [[nodiscard]] static std::optional<Socket>
+  [[nodiscard]] static Result<Socket> create(Type type = Type::TCP,
+                                             int family = AF_INET);
+  [[nodiscard]] static Result<Socket> create_bind(const SocketAddr &addr,
+                                                  Type type = Type::TCP);
+  [[nodiscard]] static Result<Socket>
   create_connect(const SocketAddr &addr, Type type = Type::TCP);
-
-  [[nodiscard]] std::error_code set_options(const SocketOptions &options);
-
-  [[nodiscard]] bool bind(const SocketAddr &addr);
-  [[nodiscard]] bool listen(int backlog = 128);
-  [[nodiscard]] std::optional<std::pair<Socket, SocketAddr>> accept();
-  [[nodiscard]] bool connect(const SocketAddr &addr);
-
-  [[nodiscard]] std::optional<std::size_t>
-  send(std::span<const std::byte> data);
-  [[nodiscard]] std::optional<std::size_t> send(std::string_view data);
-  [[nodiscard]] std::optional<std::size_t>
-  send_to(std::span<const std::byte> data, const SocketAddr &addr);
-
-  [[nodiscard]] std::optional<std::size_t> recv(std::span<std::byte> buffer);
-  [[nodiscard]] std::optional<std::size_t> recv(std::span<char> buffer);
-  [[nodiscard]] std::optional<std::string>
-  recv_string(std::size_t max_length = 4096);
-  [[nodiscard]] std::optional<std::string>
-  recv_line(std::size_t max_length = 4096);
-  [[nodiscard]] std::optional<std::string>
+  // take ownership of an fd created elsewhere (e.g. accepted by io_uring)
+  [[nodiscard]] static Socket adopt(int fd, State state = State::Connect,
+                                    Type type = Type::TCP,
+                                    int family = AF_INET) noexcept;
+
+  [[nodiscard]] Result<void> set_options(const SocketOptions &options);
+  [[nodiscard]] Result<void> set_blocking(bool blocking);
+  [[nodiscard]] Result<void> set_quick_ack(bool quick_ack);
+
+  [[nodiscard]] Result<void> bind(const SocketAddr &addr);
+  [[nodiscard]] Result<void> listen(int backlog = 128);
+  // Accepts one pending connection. The new socket is close-on-exec and, with
+  // `blocking` false, non-blocking from the start (accept4(2) on Linux, so no
+  // extra fcntl() calls). Fails with a would_block() error once the backlog
+  // is empty on a non-blocking listener.
+  [[nodiscard]] Result<std::pair<Socket, SocketAddr>>
+  accept(bool blocking = true);
+  [[nodiscard]] Result<void> connect(const SocketAddr &addr);
+
+  [[nodiscard]] Result<std::size_t> send(std::span<const std::byte> data);
+  [[nodiscard]] Result<std::size_t> send(std::string_view data);
+  // Sends the buffers in `iov` with a single sendmsg(2) and advances `iov`
+  // past what went out: fully sent buffers are dropped from the front and a
+  // partially sent one is trimmed in place, so after a short write the same
+  // call resumes where it stopped. `more` (MSG_MORE) holds back a partial TCP
+  // segment for data that follows right away, e.g. a send_file() body.
+  [[nodiscard]] Result<std::size_t> sendv(std::span<iovec> &iov,
+                                          bool more = false);
+  [[nodiscard]] Result<std::size_t> send_to(std::span<const std::byte> data,
+                                            const SocketAddr &addr);
+  // Sends up to `length` bytes of the file `file_fd` starting at `offset`
+  // without copying them through user memory (sendfile(2), falling back to
+  // splice(2) through a pipe). The file offset of `file_fd` is not changed.
+  [[nodiscard]] Result<std::size_t> send_file(int file_fd, off_t offset,
+                                              std::size_t length);
+
+  [[nodiscard]] Result<std::size_t> recv(std::span<std::byte> buffer);
+  [[nodiscard]] Result<std::size_t> recv(std::span<char> buffer);
+  [[nodiscard]] Result<std::string> recv_string(std::size_t max_length = 4096);
+  [[nodiscard]] Result<std::string> recv_line(std::size_t max_length = 4096);
+  [[nodiscard]] Result<std::string>
   recv_until(std::string_view delim, std::size_t max_length = 4096);
-  [[nodiscard]] std::optional<std::pair<std::size_t, SocketAddr>>
+  [[nodiscard]] Result<std::pair<std::size_t, SocketAddr>>
   recv_from(std::span<std::byte> buffer);
 
   [[nodiscard]] bool isValid() const noexcept;
   [[nodiscard]] int fd() const noexcept;
   [[nodiscard]] State state() const noexcept;
   [[nodiscard]] Type type() const noexcept;
+  [[nodiscard]] int family() const noexcept;
 
-  [[nodiscard]] std::optional<SocketAddr> local_addr() const;
-  [[nodiscard]] std::optional<SocketAddr> remote_addr() const;
+  [[nodiscard]] Result<SocketAddr> local_addr() const;
+  [[nodiscard]] Result<SocketAddr> remote_addr() const;
+  // connections a listening TCP socket has completed but not yet handed to
+  // accept() (TCP_INFO; not_supported where that is unavailable)
+  [[nodiscard]] Result<uint32_t> accept_queue_length() const;
 
-  [[nodiscard]] std::error_code shutdown(bool read = true, bool write = true);
+  [[nodiscard]] Result<void> shutdown(bool read = true, bool write = true);
   void close() noexcept;
 
-  [[nodiscard]] error_code last_error() const noexcept;
-
 private:
-  struct Impl; // socket underlying implementation (so I can work on both my mac
-               // device and ubuntu)
-  std::unique_ptr<Impl> _impl;
-  Socket(std::unique_ptr<Impl> impl) noexcept;
+  Socket(FileDescriptor fd, Type type, State state, int family) noexcept;
+
+  [[nodiscard]] bool set_option(int level, int option_name,
+                                const void *option_value,
+                                socklen_t option_length) const noexcept;
+  template <typename T>
+  [[nodiscard]] bool set_option(int level, int option_name,
+                                const T &value) const noexcept {
+    return set_option(level, option_name, &value, sizeof(value));
+  }
 
   [[nodiscard]] bool can_bind() const noexcept;
   [[nodiscard]] bool can_listen() const noexcept;
   [[nodiscard]] bool can_accept() const noexcept;
   [[nodiscard]] bool can_connect() const noexcept;
   [[nodiscard]] bool can_send_recv() const noexcept;
+
+  FileDescriptor _fd;
+  Type _type{Type::TCP};
+  State _state{State::Create};
+  sa_family_t _family{AF_INET};
 };
 
+// Readiness notification for many fds. Interest and readiness are always
+// expressed with the poll(2) flags (POLLIN, POLLOUT, ...) whichever backend is
+// doing the work:
+//  - Backend::Poll hands the whole pollfd array to poll(2) on every call.
+//  - Backend::Epoll (Linux) registers each fd once with the kernel, so a wakeup
+//    only costs the number of ready fds, not the number of registered ones.
+//    Trigger::Edge reports a fd only when it becomes ready again, so callbacks
+//    must read/write until EAGAIN.
 class Poll {
 public:
   using Callback = std::function<void(int fd, short events)>;
 
-  Poll() = default;
+  enum class Backend { Poll, Epoll };
+  enum class Trigger { Level, Edge };
+
+  static constexpr Backend default_backend() noexcept {
+#ifdef __linux__
+    return Backend::Epoll;
+#else
+    return Backend::Poll;
+#endif
+  }
+
+  explicit Poll(Backend backend = default_backend(),
+                Trigger trigger = Trigger::Level);
   ~Poll() noexcept = default;
 
+  Poll(const Poll &) = delete;
+  Poll &operator=(const Poll &) = delete;
+
   void add(int fd, short events, Callback callback);
 
   template <SocketLike T>
@@ -223,15 +356,35 @@ public:
 
   void process_events();
 
-  [[nodiscard]] std::size_t size() const noexcept { return _fds.size(); }
-  [[nodiscard]] bool empty() const noexcept { return _fds.empty(); }
+  [[nodiscard]] std::size_t size() const noexcept { return _callbacks.size(); }
+  [[nodiscard]] bool empty() const noexcept { return _callbacks.empty(); }
   [[nodiscard]] bool contains(int fd) const noexcept;
 
+  [[nodiscard]] Backend backend() const noexcept { return _backend; }
+  [[nodiscard]] Trigger trigger() const noexcept { return _trigger; }
+
 private:
+  Backend _backend;
+  Trigger _trigger;
+
+  // Backend::Poll
   std::vector<pollfd> _fds;
+  std::unordered_map<int, std::size_t> _index; // fd -> position in _fds
+
+  // Backend::Epoll
+  FileDescriptor _epoll_fd;
+  std::vector<epoll_event> _epoll_events; // epoll_wait() output buffer
+
   std::unordered_map<int, Callback> _callbacks;
   std::vector<std::pair<int, short>> _pending_events;
 };
 
 } // namespace wnet
+
+template <> struct std::hash<wnet::SocketAddr> {
+  std::size_t operator()(const wnet::SocketAddr &addr) const noexcept {
+    return addr.hash();
+  }
+};
+
 #endif
@@ -0,0 +1,21 @@
+#ifndef STRINGHASH_H_
+#define STRINGHASH_H_
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+// Transparent hash for maps keyed by std::string, so they can be searched
+// with a string_view (a request path, say) without building a string first.
+struct StringHash {
+  using is_transparent = void;
+  std::size_t operator()(std::string_view s) const noexcept {
+    return std::hash<std::string_view>{}(s);
+  }
+};
+
+template <typename T>
+using StringMap = std::unordered_map<std::string, T, StringHash, std::equal_to<>>;
+
+#endif
@@ -0,0 +1,467 @@
+#include "uring.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+#include <optional>
+#include <span>
+#include <vector>
+
+#ifdef __linux__
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace wnet {
+
+#ifdef __linux__
+namespace {
+int io_uring_setup(unsigned entries, io_uring_params *params) {
+  return static_cast<int>(::syscall(__NR_io_uring_setup, entries, params));
+}
+
+int io_uring_enter(int fd, unsigned to_submit, unsigned min_complete,
+                   unsigned flags, const void *arg = nullptr,
+                   std::size_t arg_size = 0) {
+  return static_cast<int>(::syscall(__NR_io_uring_enter, fd, to_submit,
+                                    min_complete, flags, arg, arg_size));
+}
+
+int io_uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+  return static_cast<int>(
+      ::syscall(__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+// the ring indices are shared with the kernel
+unsigned load_acquire(unsigned *p) noexcept {
+  return std::atomic_ref<unsigned>(*p).load(std::memory_order_acquire);
+}
+
+void store_release(unsigned *p, unsigned v) noexcept {
+  std::atomic_ref<unsigned>(*p).store(v, std::memory_order_release);
+}
+
+struct Mapping {
+  void *ptr{MAP_FAILED};
+  std::size_t size{0};
+
+  Mapping() = default;
+  Mapping(void *p, std::size_t s) : ptr(p), size(s) {}
+  Mapping(const Mapping &) = delete;
+  Mapping &operator=(const Mapping &) = delete;
+  Mapping &operator=(Mapping &&other) noexcept {
+    std::swap(ptr, other.ptr);
+    std::swap(size, other.size);
+    return *this;
+  }
+  ~Mapping() {
+    if (ptr != MAP_FAILED)
+      ::munmap(ptr, size);
+  }
+
+  [[nodiscard]] bool is_valid() const noexcept { return ptr != MAP_FAILED; }
+  template <typename T> [[nodiscard]] T *at(std::size_t offset) const noexcept {
+    return reinterpret_cast<T *>(static_cast<char *>(ptr) + offset);
+  }
+};
+} // namespace
+
+struct Uring::Impl {
+  int ring_fd{-1};
+
+  Mapping sq_ring;
+  Mapping cq_ring; // unmapped (shares sq_ring) with IORING_FEAT_SINGLE_MMAP
+  Mapping sqe_map;
+
+  unsigned *sq_head{nullptr};
+  unsigned *sq_tail{nullptr};
+  unsigned sq_mask{0};
+  unsigned sq_entries{0};
+  io_uring_sqe *sqes{nullptr};
+  unsigned sqe_tail{0}; // prepared but not yet published to the kernel
+  unsigned to_submit{0};
+  bool ext_arg{false}; // io_uring_enter() takes a wait timeout
+
+  unsigned *cq_head{nullptr};
+  unsigned *cq_tail{nullptr};
+  unsigned cq_mask{0};
+  io_uring_cqe *cqes{nullptr};
+  std::vector<Completion> completions;
+  std::vector<Completion> backlog; // taken by next_sqe(), for the next reap()
+  int error{0}; // why the kernel refused an SQE, for submit_and_wait()
+  // what a refused operation is written to
+  alignas(io_uring_sqe) std::array<char, sizeof(io_uring_sqe)> discarded;
+
+  Mapping buf_ring_map;
+  io_uring_buf_ring *buf_ring{nullptr};
+  std::unique_ptr<char[]> buffers;
+  uint32_t buf_size{0};
+  uint16_t buf_mask{0};
+  uint16_t buf_tail{0};
+
+  Impl() = default;
+  Impl(const Impl &) = delete;
+  Impl &operator=(const Impl &) = delete;
+  ~Impl() {
+    if (ring_fd >= 0)
+      ::close(ring_fd); // the kernel frees the ring once it is also unmapped
+  }
+
+  void publish() noexcept { store_release(sq_tail, sqe_tail); }
+
+  // When the SQ is full, what is queued goes to the kernel first, which
+  // consumes it synchronously. If the kernel wants the CQ reaped before it
+  // takes more (EBUSY), is short of memory (EAGAIN) or is interrupted, the
+  // completions are moved to `backlog` and it is asked again. Any other
+  // failure leaves the ring unusable: the operation is discarded and
+  // submit_and_wait() reports the error.
+  io_uring_sqe *next_sqe() {
+    while (sqe_tail - load_acquire(sq_head) >= sq_entries) {
+      publish();
+      const int ret = io_uring_enter(ring_fd, to_submit, 0, 0);
+      if (ret >= 0) {
+        to_submit -= std::min<unsigned>(to_submit, ret);
+        continue;
+      }
+      if (errno != EBUSY && errno != EAGAIN && errno != EINTR) {
+        error = errno;
+        return reinterpret_cast<io_uring_sqe *>(discarded.data());
+      }
+      take_completions(backlog);
+    }
+
+    io_uring_sqe *sqe = &sqes[sqe_tail & sq_mask];
+    std::memset(sqe, 0, sizeof(*sqe));
+    ++sqe_tail;
+    ++to_submit;
+    return sqe;
+  }
+
+  void take_completions(std::vector<Completion> &into) {
+    unsigned head = *cq_head; // only we advance the head
+    const unsigned tail = load_acquire(cq_tail);
+    for (; head != tail; ++head) {
+      const io_uring_cqe &cqe = cqes[head & cq_mask];
+      into.push_back(Completion{
+          .user_data = cqe.user_data, .res = cqe.res, .flags = cqe.flags});
+    }
+    store_release(cq_head, head);
+  }
+
+  void add_buffer(uint16_t bid) noexcept {
+    // not buf_ring->bufs: in C++ the kernel's flex array macro puts a 1 byte
+    // empty struct in front of it, while the ring really starts at offset 0
+    io_uring_buf &buf =
+        reinterpret_cast<io_uring_buf *>(buf_ring)[buf_tail & buf_mask];
+    buf.addr = reinterpret_cast<uint64_t>(buffers.get() +
+                                          static_cast<std::size_t>(bid) *
+                                              buf_size);
+    buf.len = buf_size;
+    buf.bid = bid;
+    ++buf_tail;
+  }
+
+  void publish_buffers() noexcept {
+    std::atomic_ref<uint16_t>(buf_ring->tail)
+        .store(buf_tail, std::memory_order_release);
+  }
+
+  [[nodiscard]] bool supports(std::initializer_list<int> ops) const {
+    constexpr unsigned probe_ops = 256;
+    std::vector<char> storage(sizeof(io_uring_probe) +
+                              probe_ops * sizeof(io_uring_probe_op));
+    auto *probe = reinterpret_cast<io_uring_probe *>(storage.data());
+    if (io_uring_register(ring_fd, IORING_REGISTER_PROBE, probe, probe_ops) <
+        0) {
+      return false;
+    }
+
+    for (int op : ops) {
+      if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+        return false;
+    }
+    return true;
+  }
+};
+
+bool Uring::Completion::more() const noexcept {
+  return flags & IORING_CQE_F_MORE;
+}
+
+std::optional<uint16_t> Uring::Completion::buffer_id() const noexcept {
+  if (!(flags & IORING_CQE_F_BUFFER))
+    return std::nullopt;
+  return static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+}
+
+std::optional<Uring> Uring::create(unsigned entries) {
+  auto impl = std::make_unique<Impl>();
+
+  io_uring_params params{};
+  // we only ever submit from one thread and reap in our own loop
+  params.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+  impl->ring_fd = io_uring_setup(entries, &params);
+  if (impl->ring_fd < 0 && errno == EINVAL) { // kernel predates those flags
+    params = io_uring_params{};
+    impl->ring_fd = io_uring_setup(entries, &params);
+  }
+  if (impl->ring_fd < 0) {
+    return std::nullopt;
+  }
+
+  std::size_t sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  std::size_t cq_size =
+      params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+  const bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+  if (single_mmap) {
+    sq_size = cq_size = std::max(sq_size, cq_size);
+  }
+
+  impl->sq_ring = Mapping(
+      ::mmap(nullptr, sq_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+             impl->ring_fd, IORING_OFF_SQ_RING),
+      sq_size);
+  if (!impl->sq_ring.is_valid())
+    return std::nullopt;
+
+  if (!single_mmap) {
+    impl->cq_ring = Mapping(
+        ::mmap(nullptr, cq_size, PROT_READ | PROT_WRITE,
+               MAP_SHARED | MAP_POPULATE, impl->ring_fd, IORING_OFF_CQ_RING),
+        cq_size);
+    if (!impl->cq_ring.is_valid())
+      return std::nullopt;
+  }
+  const Mapping &cq = single_mmap ? impl->sq_ring : impl->cq_ring;
+
+  const std::size_t sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+  impl->sqe_map = Mapping(
+      ::mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE,
+             MAP_SHARED | MAP_POPULATE, impl->ring_fd, IORING_OFF_SQES),
+      sqes_size);
+  if (!impl->sqe_map.is_valid())
+    return std::nullopt;
+
+  impl->sq_head = impl->sq_ring.at<unsigned>(params.sq_off.head);
+  impl->sq_tail = impl->sq_ring.at<unsigned>(params.sq_off.tail);
+  impl->sq_mask = *impl->sq_ring.at<unsigned>(params.sq_off.ring_mask);
+  impl->sq_entries = params.sq_entries;
+  impl->sqes = impl->sqe_map.at<io_uring_sqe>(0);
+  impl->sqe_tail = *impl->sq_tail;
+
+  // sqe slot i is always submitted through array slot i
+  unsigned *sq_array = impl->sq_ring.at<unsigned>(params.sq_off.array);
+  for (unsigned i = 0; i < params.sq_entries; ++i) {
+    sq_array[i] = i;
+  }
+
+  impl->cq_head = cq.at<unsigned>(params.cq_off.head);
+  impl->cq_tail = cq.at<unsigned>(params.cq_off.tail);
+  impl->cq_mask = *cq.at<unsigned>(params.cq_off.ring_mask);
+  impl->cqes = cq.at<io_uring_cqe>(params.cq_off.cqes);
+  impl->completions.reserve(params.cq_entries);
+  impl->ext_arg = params.features & IORING_FEAT_EXT_ARG;
+
+  if (!impl->supports({IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_SEND,
+                       IORING_OP_SENDMSG, IORING_OP_READ,
+                       IORING_OP_ASYNC_CANCEL})) {
+    return std::nullopt;
+  }
+
+  return Uring{std::move(impl)};
+}
+
+bool Uring::setup_buffers(uint16_t group, uint16_t count, uint32_t size) {
+  if (count == 0 || (count & (count - 1)) != 0) {
+    errno = EINVAL;
+    return false;
+  }
+
+  const std::size_t ring_size = count * sizeof(io_uring_buf);
+  Mapping ring(::mmap(nullptr, ring_size, PROT_READ | PROT_WRITE,
+                      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0),
+               ring_size);
+  if (!ring.is_valid())
+    return false;
+
+  io_uring_buf_reg reg{};
+  reg.ring_addr = reinterpret_cast<uint64_t>(ring.ptr);
+  reg.ring_entries = count;
+  reg.bgid = group;
+  if (io_uring_register(_impl->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) !=
+      0) {
+    return false; // needs Linux 5.19
+  }
+
+  _impl->buf_ring = static_cast<io_uring_buf_ring *>(ring.ptr);
+  _impl->buf_ring_map = std::move(ring);
+  _impl->buffers = std::make_unique<char[]>(static_cast<std::size_t>(count) * size);
+  _impl->buf_size = size;
+  _impl->buf_mask = static_cast<uint16_t>(count - 1);
+  _impl->buf_tail = 0;
+
+  for (uint16_t bid = 0; bid < count; ++bid) {
+    _impl->add_buffer(bid);
+  }
+  _impl->publish_buffers();
+  return true;
+}
+
+std::span<const char> Uring::buffer(uint16_t bid,
+                                    std::size_t length) const noexcept {
+  return {_impl->buffers.get() + static_cast<std::size_t>(bid) * _impl->buf_size,
+          length};
+}
+
+void Uring::recycle_buffer(uint16_t bid) noexcept {
+  _impl->add_buffer(bid);
+  _impl->publish_buffers();
+}
+
+void Uring::prep_accept(int fd, uint64_t user_data, bool multishot) {
+  io_uring_sqe *sqe = _impl->next_sqe();
+  sqe->opcode = IORING_OP_ACCEPT;
+  sqe->fd = fd;
+  sqe->accept_flags = SOCK_CLOEXEC;
+  if (multishot)
+    sqe->ioprio |= IORING_ACCEPT_MULTISHOT;
+  sqe->user_data = user_data;
+}
+
+void Uring::prep_recv(int fd, uint16_t group, uint64_t user_data,
+                      bool multishot) {
+  io_uring_sqe *sqe = _impl->next_sqe();
+  sqe->opcode = IORING_OP_RECV;
+  sqe->fd = fd;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = group;
+  if (multishot)
+    sqe->ioprio |= IORING_RECV_MULTISHOT;
+  sqe->user_data = user_data;
+}
+
+void Uring::prep_send(int fd, std::span<const char> data, uint64_t user_data) {
+  io_uring_sqe *sqe = _impl->next_sqe();
+  sqe->opcode = IORING_OP_SEND;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(data.data());
+  sqe->len = static_cast<uint32_t>(data.size());
+  sqe->msg_flags = MSG_NOSIGNAL;
+  sqe->user_data = user_data;
+}
+
+void Uring::prep_sendmsg(int fd, const msghdr *msg, uint64_t user_data,
+                         bool more) {
+  io_uring_sqe *sqe = _impl->next_sqe();
+  sqe->opcode = IORING_OP_SENDMSG;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(msg);
+  sqe->len = 1;
+  sqe->msg_flags = MSG_NOSIGNAL | (more ? MSG_MORE : 0);
+  sqe->user_data = user_data;
+}
+
+void Uring::prep_read(int fd, std::span<char> buffer, uint64_t offset,
+                      uint64_t user_data) {
+  io_uring_sqe *sqe = _impl->next_sqe();
+  sqe->opcode = IORING_OP_READ;
+  sqe->fd = fd;
+  sqe->addr = reinterpret_cast<uint64_t>(buffer.data());
+  sqe->len = static_cast<uint32_t>(buffer.size());
+  sqe->off = offset;
+  sqe->user_data = user_data;
+}
+
+void Uring::prep_cancel(uint64_t target_user_data, uint64_t user_data) {
+  io_uring_sqe *sqe = _impl->next_sqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = -1;
+  sqe->addr = target_user_data;
+  sqe->user_data = user_data;
+}
+
+void Uring::prep_cancel_fd(int fd, uint64_t user_data) {
+  io_uring_sqe *sqe = _impl->next_sqe();
+  sqe->opcode = IORING_OP_ASYNC_CANCEL;
+  sqe->fd = fd;
+  sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+  sqe->user_data = user_data;
+}
+
+int Uring::submit_and_wait(unsigned wait_nr,
+                           std::chrono::milliseconds timeout) {
+  if (_impl->error != 0) { // from next_sqe()
+    return -_impl->error;
+  }
+  if (!_impl->backlog.empty()) {
+    wait_nr = 0; // reap() already has completions to return
+  }
+  _impl->publish();
+
+  int ret;
+  if (timeout.count() >= 0 && _impl->ext_arg) {
+    __kernel_timespec ts{.tv_sec = timeout.count() / 1000,
+                         .tv_nsec = (timeout.count() % 1000) * 1000000};
+    io_uring_getevents_arg arg{};
+    arg.ts = reinterpret_cast<uint64_t>(&ts);
+    ret = io_uring_enter(_impl->ring_fd, _impl->to_submit, wait_nr,
+                         IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg,
+                         sizeof(arg));
+  } else { // without EXT_ARG (before 5.11) there is no wait timeout
+    ret = io_uring_enter(_impl->ring_fd, _impl->to_submit, wait_nr,
+                         IORING_ENTER_GETEVENTS);
+  }
+  if (ret < 0) {
+    return -errno;
+  }
+  _impl->to_submit -= std::min<unsigned>(_impl->to_submit, ret);
+  return ret;
+}
+
+std::span<const Uring::Completion> Uring::reap() {
+  _impl->completions.clear();
+  std::swap(_impl->completions, _impl->backlog); // those came first
+  _impl->take_completions(_impl->completions);
+  return _impl->completions;
+}
+
+#else // io_uring is Linux only; create() always reports it as unavailable
+
+struct Uring::Impl {};
+
+bool Uring::Completion::more() const noexcept { return false; }
+std::optional<uint16_t> Uring::Completion::buffer_id() const noexcept {
+  return std::nullopt;
+}
+std::optional<Uring> Uring::create(unsigned) { return std::nullopt; }
+bool Uring::setup_buffers(uint16_t, uint16_t, uint32_t) { return false; }
+std::span<const char> Uring::buffer(uint16_t, std::size_t) const noexcept {
+  return {};
+}
+void Uring::recycle_buffer(uint16_t) noexcept {}
+void Uring::prep_accept(int, uint64_t, bool) {}
+void Uring::prep_recv(int, uint16_t, uint64_t, bool) {}
+void Uring::prep_send(int, std::span<const char>, uint64_t) {}
+void Uring::prep_sendmsg(int, const msghdr *, uint64_t, bool) {}
+void Uring::prep_read(int, std::span<char>, uint64_t, uint64_t) {}
+void Uring::prep_cancel(uint64_t, uint64_t) {}
+void Uring::prep_cancel_fd(int, uint64_t) {}
+int Uring::submit_and_wait(unsigned, std::chrono::milliseconds) {
+  return -ENOSYS;
+}
+std::span<const Uring::Completion> Uring::reap() { return {}; }
+
+#endif
+
+Uring::Uring(std::unique_ptr<Impl> impl) noexcept : _impl(std::move(impl)) {}
+Uring::Uring(Uring &&other) noexcept = default;
+Uring &Uring::operator=(Uring &&other) noexcept = default;
+Uring::~Uring() noexcept = default;
+
+} // namespace wnet
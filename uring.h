@@ -0,0 +1,85 @@
+#ifndef URING_H_
+#define URING_H_
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <span>
+#include <sys/socket.h>
+#include <vector>
+
+namespace wnet {
+
+// Minimal io_uring wrapper built directly on the io_uring_setup/enter/register
+// syscalls (no liburing dependency). Operations are only queued by the prep
+// functions; nothing reaches the kernel until submit_and_wait(), so a whole
+// event loop iteration worth of accepts, receives, sends and file reads costs a
+// single syscall.
+//
+// Receives use a ring of provided buffers: the kernel picks a free buffer when
+// data arrives, reports its id in the completion, and the caller hands it back
+// with recycle_buffer() once the bytes have been consumed.
+class Uring {
+public:
+  struct Completion {
+    uint64_t user_data;
+    int32_t res; // bytes/fd on success, -errno on failure
+    uint32_t flags;
+
+    // the request is multishot and will produce more completions
+    [[nodiscard]] bool more() const noexcept;
+    // the provided buffer the kernel filled, if any
+    [[nodiscard]] std::optional<uint16_t> buffer_id() const noexcept;
+  };
+
+  Uring(Uring &&other) noexcept;
+  Uring &operator=(Uring &&other) noexcept;
+  ~Uring() noexcept;
+
+  Uring(const Uring &) = delete;
+  Uring &operator=(const Uring &) = delete;
+
+  // nullopt if io_uring is unavailable (old kernel, seccomp, not Linux) or does
+  // not support the operations the server relies on
+  [[nodiscard]] static std::optional<Uring> create(unsigned entries = 256);
+
+  // registers `count` (power of two) buffers of `size` bytes as group `group`
+  [[nodiscard]] bool setup_buffers(uint16_t group, uint16_t count,
+                                   uint32_t size);
+  [[nodiscard]] std::span<const char> buffer(uint16_t bid,
+                                             std::size_t length) const noexcept;
+  void recycle_buffer(uint16_t bid) noexcept;
+
+  void prep_accept(int fd, uint64_t user_data, bool multishot);
+  void prep_recv(int fd, uint16_t group, uint64_t user_data, bool multishot);
+  void prep_send(int fd, std::span<const char> data, uint64_t user_data);
+  // `msg` and the iovecs it points to must stay valid until the completion;
+  // `more` sets MSG_MORE, for data that another send follows right away
+  void prep_sendmsg(int fd, const msghdr *msg, uint64_t user_data,
+                    bool more = false);
+  void prep_read(int fd, std::span<char> buffer, uint64_t offset,
+                 uint64_t user_data);
+  void prep_cancel(uint64_t target_user_data, uint64_t user_data);
+  // cancels every operation on `fd` (Linux 5.19+; -EINVAL before that)
+  void prep_cancel_fd(int fd, uint64_t user_data);
+
+  // submits everything queued and waits for at least `wait_nr` completions,
+  // or until `timeout` (if not negative) has passed; returns -errno on failure
+  // (-EINTR when interrupted by a signal, -ETIME when the timeout expired),
+  // including one that made a prep function drop its operation
+  [[nodiscard]] int
+  submit_and_wait(unsigned wait_nr = 1,
+                  std::chrono::milliseconds timeout = std::chrono::milliseconds(-1));
+
+  // completions that arrived since the last call, valid until the next call
+  [[nodiscard]] std::span<const Completion> reap();
+
+private:
+  struct Impl; // ring mappings and raw kernel structures
+  std::unique_ptr<Impl> _impl;
+  explicit Uring(std::unique_ptr<Impl> impl) noexcept;
+};
+
+} // namespace wnet
+#endif
@@ -1,11 +1,25 @@
 // **************************************************************************************
 // * webServer (webServer.cpp)
-// * - Implements a very limited subset of HTTP/1.0, use -v to enable verbose
+// * - Implements a very limited subset of HTTP/1.1, use -v to enable verbose
 // debugging output.
 // * - Port number 1701 is the default, if in use random number is selected.
+// * - Clients are served concurrently by -t worker threads (one per core by
+// *   default), each running its own non-blocking event loop on its own
+// *   SO_REUSEPORT listening socket.
+// * - Connections persist across requests (HTTP/1.1 by default, HTTP/1.0 with
+// *   "Connection: keep-alive") until the client closes them, they are idle for
+// *   -k seconds or have made -m requests.
+// * - GET /metrics reports request, cache and connection counters and a
+// *   latency histogram in the Prometheus text format, plus p50/p99/p99.9 of
+// *   every request phase; SIGUSR1 prints those quantiles to stderr.
+// * - -A PREFIX records every response in a binary access log per worker
+// *   (PREFIX.N.bin, see accesslog.h); accesslogdecode prints them.
 // *
-// * - GET requests are processed, all other metods result in 400.
-// *     All header gracefully ignored
+// * - GET and HEAD requests are processed, all other metods result in 400.
+// *     Header fields are parsed; the server acts on Connection (keep-alive
+// *     and close) and If-None-Match (304 when the ETag still matches) and
+// *     ignores the rest. A Content-Length body is read past and dropped;
+// *     Transfer-Encoding is answered with 400.
 // *     Files will only be served from cwd and must have format file\d.html or
 // image\d.jpg
 // *
@@ -13,6 +27,9 @@
 // *     status line (i.e., response method)
 // *     Cotent-Length:
 // *     Content-Type:
+// *     ETag:
+// *     Connection: (close when the server closes after the response,
+// *     keep-alive for a persistent HTTP/1.0 connection)
 // *     \r\n
 // *     requested file.
 // *
@@ -26,227 +43,598 @@
 // * - Program is terminated with SIGINT (ctrl-C)
 // **************************************************************************************
 #include "webServer.h"
+#include "accesslog.h"
+#include "buffer.h"
+#include "filecache.h"
+#include "http.h"
 #include "logging.h"
+#include "metrics.h"
+#include "routes.h"
 #include "socket.h"
+#include "uring.h"
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <cerrno>
+#include <chrono>
 #include <csignal>
+#include <cstring>
 #include <exception>
 #include <filesystem>
 #include <format>
+#include <iterator>
+#include <memory>
 #include <optional>
 #include <random>
-#include <regex>
-#include <sstream>
+#include <span>
+#include <stdexcept>
 #include <string>
 #include <string_view>
 #include <system_error>
+#include <thread>
 #include <unordered_map>
+#include <utility>
+#include <vector>
 
 std::atomic_bool shutdown_requested{false};
+std::atomic_int shutdown_signal{0};
 // **************************************************************************************
 // * Signal Handler.
-// * - Display the signal and exit (returning 0 to OS indicating normal
-// shutdown)
+// * - Record the signal and ask the event loops to stop; main() reports it
+// *   once they have (logging is not async-signal-safe).
 // * - Optional for 471, required for 598
 // **************************************************************************************
 void sig_handler(int signo) {
-  INFO << std::format("Received signal {}, shutting down...", signo) << ENDL;
+  shutdown_signal.store(signo);
   shutdown_requested.store(true);
 }
 
-enum class HttpRequestType {
-  GET,
-  HEAD,
-  POST,
-  INVALID,
-};
+// SIGUSR1: only raises a flag; whichever event loop sees it first prints
+// the phase latency report (see dump_if_requested()).
+std::atomic_bool dump_requested{false};
 
-struct HttpRequest {
-  HttpRequestType method{HttpRequestType::INVALID};
-  std::string path;
-  std::string http_version;
-  std::unordered_map<std::string, std::string> headers;
+void dump_handler(int) { dump_requested.store(true); }
+
+bool is_valid_filename(std::string_view filename) {
+  return SERVABLE_PATHS.contains(filename);
+}
+
+// **************************************************************************************
+// * Connection
+// * -- per-client state for the event loop. A connection reads until it has at
+// *    least one full header, queues a response for every complete request in
+// *    its input (pipelining), writes the whole batch as the socket allows and
+// *    then either goes back to reading or, when the connection is not kept
+// *    alive, lingers and is closed. Request bodies are read past and dropped:
+// *    the server uses none, and one left in the input would be parsed as the
+// *    next request.
+// *
+// *    Lingering: closing a socket with unread input makes the kernel send an
+// *    RST, and an RST makes the client discard responses it has not read
+// *    yet, e.g. the last ones of a pipelined batch. So after the last
+// *    response our side is shut down (the client sees a FIN after it), and
+// *    input is read and dropped until the client closes too or
+// *    LINGER_TIMEOUT passes.
+// **************************************************************************************
+constexpr std::size_t MAX_HEADER_SIZE = 8192;
+constexpr std::size_t RECV_CHUNK_SIZE = 4096;
+constexpr std::size_t MAX_PIPELINED = 16; // responses queued per batch
+// a response is at most three pieces: its part of Connection::out, a cached
+// header and the cached bytes after it
+constexpr std::size_t IOV_BATCH = 3 * MAX_PIPELINED;
+
+struct KeepAlive {
+  std::chrono::seconds idle_timeout{10}; // without any progress on the socket
+  unsigned max_requests{100};            // per connection
 };
 
-std::string_view get_content_type(std::string_view filename) {
-  if (filename.ends_with(".html")) {
-    return "text/html";
-  } else if (filename.ends_with(".jpg") || filename.ends_with(".jpeg")) {
-    return "image/jpeg";
-  } else {
-    return "application/octet-stream";
+// how often the engines look for connections past the idle timeout
+constexpr std::chrono::milliseconds IDLE_SWEEP_INTERVAL{1000};
+// longest a closing connection waits for the client's FIN
+constexpr std::chrono::seconds LINGER_TIMEOUT{2};
+
+// Prints metrics::latency_report() to stderr, whatever the log level, if
+// SIGUSR1 asked for it. Called by the event loops on every iteration; the
+// signal interrupts their wait, or they get to it within an idle sweep.
+void dump_if_requested() {
+  if (!dump_requested.load(std::memory_order_relaxed) ||
+      !dump_requested.exchange(false)) {
+    return;
   }
+  const std::string report = metrics::latency_report();
+  logging::flush(); // after anything logged before the signal
+  std::cerr << report << std::flush;
 }
 
-bool is_valid_filename(std::string_view filename) {
-  static const std::regex valid{R"(^/(file[0-9]\.html|image[0-9]\.jpg)$)"};
-  return std::regex_match(filename.begin(), filename.end(), valid);
+// Out of fds (EMFILE, ENFILE), the listener stays readable and every accept
+// fails at once, so the engines stop accepting until a connection closes or
+// the next idle sweep, and say so at most once per ACCEPT_WARNING_INTERVAL.
+constexpr std::chrono::seconds ACCEPT_WARNING_INTERVAL{10};
+
+void warn_accept_paused(std::string_view reason) {
+  using clock = std::chrono::steady_clock;
+  thread_local clock::time_point last_warning{};
+  thread_local unsigned suppressed = 0;
+  const auto now = clock::now();
+  if (last_warning != clock::time_point{} &&
+      now - last_warning < ACCEPT_WARNING_INTERVAL) {
+    ++suppressed;
+    return;
+  }
+  WARNING << std::format("Cannot accept connections: {}; pausing until one "
+                         "closes ({} more pauses not logged)",
+                         reason, std::exchange(suppressed, 0))
+          << ENDL;
+  last_warning = now;
 }
 
-std::optional<std::vector<std::byte>>
-read_file(const std::filesystem::path &fp) {
-  std::error_code ec;
-  if (!std::filesystem::exists(fp, ec) || ec) {
-    DEBUGL << std::format("File not found: {}", fp.string()) << ENDL;
+// refreshes this worker's accept queue gauge, on every idle sweep
+void sample_accept_queue(const wnet::Socket &listener) {
+  if (auto queued = listener.accept_queue_length()) {
+    metrics::local().accept_queue.set(*queued);
   }
+}
 
-  const auto fsize = std::filesystem::file_size(fp, ec);
-  if (ec) {
-    ERROR << std::format("Cannot ascertain file size for: {}", fp.string())
-          << ENDL;
+// When a request reached the end of each metrics::Phase.
+struct Timeline {
+  using clock = std::chrono::steady_clock;
+
+  clock::time_point accepted; // on a connection's first request only
+  clock::time_point first_byte;
+  clock::time_point parsed;
+  clock::time_point routed;
+  clock::time_point queued;
+
+  // `sent` is when the last byte went out
+  void record(metrics::Shard &stats, clock::time_point sent) const noexcept {
+    using metrics::Phase;
+    if (accepted != clock::time_point{}) {
+      stats.time_phase(Phase::Connect, first_byte - accepted);
+    }
+    stats.time_phase(Phase::Parse, parsed - first_byte);
+    stats.time_phase(Phase::Route, routed - parsed);
+    stats.time_phase(Phase::Handle, queued - routed);
+    stats.time_phase(Phase::Send, sent - queued);
+    stats.time_phase(Phase::Total, sent - first_byte);
   }
-  std::ifstream file(fp, std::ios::binary);
-  if (!file) {
-    ERROR << std::format("Cannot open file: {}", fp.string()) << ENDL;
-    return std::nullopt;
+};
+
+// One queued response, sent in this order: its header from Connection::out,
+// then a precomputed header and response (or body) from the file cache, then
+// a file body from its fd.
+struct Response {
+  std::size_t out_begin{0};
+  std::size_t out_end{0};
+
+  // holding the shared_ptr keeps the bytes alive while they are written
+  std::shared_ptr<const CachedResponse> cached;
+  std::string_view cached_header; // a variant with a Connection field
+  std::string_view cached_bytes;
+
+  // the poll engine hands the body to the kernel with sendfile(), the
+  // io_uring engine reads and sends it a chunk at a time
+  wnet::FileDescriptor body_fd;
+  std::size_t body_size{0};
+
+  std::size_t sent{0};
+  Timeline::clock::time_point sent_at; // when its bytes last went out
+  bool keep_alive{false};
+
+  // for the metrics and the access log
+  uint16_t status{200};
+  HttpRequestType method{HttpRequestType::INVALID};
+  uint32_t path_id{accesslog::NO_PATH};
+  Timeline timeline;
+
+  [[nodiscard]] std::size_t in_memory() const noexcept {
+    return out_end - out_begin + cached_header.size() + cached_bytes.size();
   }
+  [[nodiscard]] std::size_t size() const noexcept {
+    return in_memory() + body_size;
+  }
+};
 
-  std::vector<std::byte> content(fsize);
-  file.read(reinterpret_cast<char *>(content.data()), fsize);
+struct Connection {
+  enum class State { ReadingHeader, WritingResponse, Lingering, Closing };
 
-  if (!file) {
-    ERROR << std::format("Cannot read file: {}", fp.string()) << ENDL;
-    return std::nullopt;
+  using clock = std::chrono::steady_clock;
+
+  Connection(wnet::Socket s, wnet::SocketAddr a, unsigned max_requests,
+             accesslog::AccessLog *log = nullptr)
+      : socket(std::move(s)), addr(std::move(a)), requests_left(max_requests),
+        last_active(clock::now()), accepted(last_active), access_log(log) {}
+
+  wnet::Socket socket;
+  wnet::SocketAddr addr;
+  State state{State::ReadingHeader};
+  bool http11{false};     // the current request is HTTP/1.1
+  bool keep_alive{false}; // read another request after this response
+  unsigned requests_left;
+  clock::time_point last_active;
+  clock::time_point accepted;
+  clock::time_point first_byte; // of the request at the front of `in`
+  bool served{false};           // a response has been queued before
+  short interest{POLLIN}; // what the poll engine has registered
+  accesslog::AccessLog *access_log; // the worker's, if -A is set
+  wnet::RecvBuffer in{RECV_CHUNK_SIZE}; // bytes received, not yet handled
+  RequestParser parser{MAX_HEADER_SIZE}; // the request at the front of `in`
+  std::size_t body_left{0}; // of the last request's body, still to be dropped
+
+  std::string out; // serialized headers of all queued responses
+  std::vector<Response> responses; // in request order
+  std::size_t first_unsent{0};
+
+  // the response being built by the request handlers
+  [[nodiscard]] Response &response() noexcept { return responses.back(); }
+
+  // the engines call this when n bytes were appended to `in`
+  void received(std::size_t n) noexcept {
+    last_active = clock::now();
+    if (in.size() == n) { // nothing was pending, so they start a request
+      first_byte = last_active;
+    }
   }
 
-  return content;
-}
+  // drops what has arrived of the last request's body; true once all of it
+  // is gone and `in` starts at the next request
+  bool skip_body() noexcept {
+    const std::size_t n = std::min(body_left, in.size());
+    in.consume(n);
+    body_left -= n;
+    return body_left == 0;
+  }
 
-HttpRequestType parse_method(std::string_view method) {
-  if (method == "GET")
-    return HttpRequestType::GET;
-  if (method == "HEAD")
-    return HttpRequestType::HEAD;
-  if (method == "POST")
-    return HttpRequestType::POST;
-  return HttpRequestType::INVALID;
-}
+  void begin_response() {
+    Response &r = responses.emplace_back();
+    r.out_begin = out.size();
+    r.timeline.first_byte = first_byte;
+    if (!std::exchange(served, true)) {
+      r.timeline.accepted = accepted;
+    }
+  }
 
-// **************************************************************************************
-// * processRequest,
-//   - Return HTTP code to be sent back
-//   - Set filename if appropriate. Filename syntax is valided but existance
-//   is not verified.
-// **************************************************************************************
-std::optional<HttpRequest> read_header(wnet::Socket &client) {
-  auto request_data = client.recv_until("\r\n\r\n");
-  if (!request_data) {
-    ERROR << "Failed to receive request data" << ENDL;
-    return std::nullopt;
+  void end_response() {
+    Response &r = response();
+    r.keep_alive = keep_alive;
+    r.out_end = out.size();
+  }
+
+  [[nodiscard]] bool all_sent() const noexcept {
+    return first_unsent == responses.size();
+  }
+
+  // The unsent in-memory bytes of the queued responses as iovecs for
+  // Socket::sendv(), in order. Stops after a response whose body still has
+  // to go out by fd, setting `body_follows`.
+  [[nodiscard]] std::span<iovec> gather(std::span<iovec, IOV_BATCH> storage,
+                                        bool &body_follows) noexcept {
+    std::size_t count = 0;
+    auto add = [&](std::string_view data) {
+      if (!data.empty()) {
+        storage[count++] = iovec{const_cast<char *>(data.data()), data.size()};
+      }
+    };
+
+    body_follows = false;
+    for (auto i = first_unsent; i < responses.size() && count + 3 <= IOV_BATCH;
+         ++i) {
+      const Response &r = responses[i];
+      const std::array<std::string_view, 3> pieces{
+          std::string_view{out}.substr(r.out_begin, r.out_end - r.out_begin),
+          r.cached_header, r.cached_bytes};
+      std::size_t skip = r.sent;
+      for (const auto piece : pieces) {
+        const std::size_t n = std::min(skip, piece.size());
+        add(piece.substr(n));
+        skip -= n;
+      }
+      if (r.sent < r.size() && r.size() > r.in_memory()) {
+        body_follows = true;
+        break;
+      }
+    }
+    return storage.first(count);
+  }
+
+  // n bytes of gather()ed data were written
+  void advance(std::size_t n) noexcept {
+    last_active = clock::now();
+    for (auto i = first_unsent; n > 0 && i < responses.size(); ++i) {
+      Response &r = responses[i];
+      const std::size_t take =
+          std::min(n, r.in_memory() - std::min(r.sent, r.in_memory()));
+      if (take > 0) {
+        r.sent += take;
+        r.sent_at = last_active;
+      }
+      n -= take;
+    }
+    skip_sent();
   }
 
-  DEBUGL << std::format("Received request data:\n{}", *request_data) << ENDL;
+  // the response whose file body is next to go out by fd, if any
+  [[nodiscard]] Response *body_to_send() noexcept {
+    if (all_sent()) {
+      return nullptr;
+    }
+    Response &r = responses[first_unsent];
+    return r.sent >= r.in_memory() ? &r : nullptr;
+  }
 
-  auto first_newline = request_data->find("\r\n");
-  if (first_newline == std::string::npos) {
-    ERROR << "CRLF required for valid HTTP request." << ENDL;
-    return std::nullopt;
+  void advance_body(std::size_t n) noexcept {
+    last_active = clock::now();
+    Response &r = responses[first_unsent];
+    r.sent += n;
+    r.sent_at = last_active;
+    skip_sent();
   }
 
-  std::string request_line = request_data->substr(0, first_newline);
+  [[nodiscard]] std::size_t bytes_sent() const noexcept {
+    std::size_t total = 0;
+    for (const Response &r : responses) {
+      total += r.sent;
+    }
+    return total;
+  }
 
-  std::istringstream sw(request_line);
-  std::string method;
-  std::string path;
-  std::string version;
+  // the Connection header the response needs, if any. Every response says
+  // close when the connection ends after it: the status line is HTTP/1.1,
+  // and a request that failed to parse leaves http11 unknown. A persistent
+  // HTTP/1.0 connection needs keep-alive, a persistent HTTP/1.1 one nothing.
+  [[nodiscard]] std::string_view connection_token() const noexcept {
+    if (!keep_alive) {
+      return "close";
+    }
+    return http11 ? std::string_view{} : "keep-alive";
+  }
 
-  if (!(sw >> method >> path >> version)) {
-    ERROR << "Unable to parse request" << ENDL;
-    return std::nullopt;
+  // counts, logs and drops the batch, keeping any input that already
+  // arrived; the buffers keep their capacity for the next one. Also called
+  // on close, when some responses may be cut short. Each response ends
+  // when the last of its bytes that went out did (its own sent_at, so this
+  // costs no clock read), or at the close if none did.
+  void finish_batch() noexcept {
+    metrics::Shard &stats = metrics::local();
+    for (const Response &r : responses) {
+      const clock::time_point end = r.sent > 0 ? r.sent_at : last_active;
+      stats.count_request(r.method, r.status, r.sent,
+                          end - r.timeline.first_byte);
+      r.timeline.record(stats, end);
+      if (access_log != nullptr) {
+        access_log->record(addr, r.method, r.path_id, r.status, r.sent,
+                           r.timeline.first_byte, end);
+      }
+    }
+    out.clear();
+    responses.clear();
+    first_unsent = 0;
   }
 
-  HttpRequest req;
-  req.method = parse_method(method);
-  req.path = path;
-  req.http_version = version;
+  // the batch is out and was the last: shut down our side and start
+  // lingering; last_active is then when that began
+  void linger() noexcept {
+    finish_batch();
+    (void)socket.shutdown(false, true);
+    state = State::Lingering;
+    last_active = clock::now();
+  }
 
-  INFO << std::format("Successfully parsed request: {} {} {}", method, path,
-                      version)
-       << ENDL;
+  // whether the engines should give up on the connection
+  [[nodiscard]] bool timed_out(clock::time_point now,
+                               const KeepAlive &keep_alive) const noexcept {
+    const auto timeout =
+        state == State::Lingering ? LINGER_TIMEOUT : keep_alive.idle_timeout;
+    return last_active < now - timeout;
+  }
 
-  return req;
-}
+private:
+  void skip_sent() noexcept {
+    while (!all_sent() &&
+           responses[first_unsent].sent == responses[first_unsent].size()) {
+      ++first_unsent;
+    }
+  }
+};
 
-// **************************************************************************
-// * Send one line (including the line terminator <LF><CR>)
-// * - Assumes the terminator is not included, so it is appended.
-// **************************************************************************
-void send_line(wnet::Socket &socket, std::string_view line) {
-  std::string safeline = std::format("{}\r\n", line);
-  auto sent = socket.send(safeline);
-  if (!sent) {
-    ERROR << "Failed to send line" << ENDL;
+// **************************************************************************************
+// * ResponseBuilder
+// * -- serializes a status line and headers straight into the connection's
+// *    output buffer (no string per line), so the complete response goes out
+// *    with a single write.
+// **************************************************************************************
+class ResponseBuilder {
+public:
+  ResponseBuilder(std::string &out, std::string_view status) : _out(out) {
+    _out.append("HTTP/1.1 ").append(status).append("\r\n");
+  }
+
+  template <typename... Args>
+  ResponseBuilder &header(std::string_view name,
+                          std::format_string<Args...> value, Args &&...args) {
+    _out.append(name).append(": ");
+    std::format_to(std::back_inserter(_out), value,
+                   std::forward<Args>(args)...);
+    _out.append("\r\n");
+    return *this;
   }
-  DEBUGL << std::format("Sent: {}", line) << ENDL;
-}
+
+  // "Connection: <token>" unless the token is empty
+  ResponseBuilder &connection(std::string_view token) {
+    if (!token.empty()) {
+      header("Connection", "{}", token);
+    }
+    return *this;
+  }
+
+  // the blank line that ends the header
+  void end() { _out.append("\r\n"); }
+
+private:
+  std::string &_out;
+};
 
 // **************************************************************************
 // * Send the entire 404 response, header and body.
 // **************************************************************************
-void send404(wnet::Socket &socket) {
+void send404(Connection &conn) {
   INFO << "Sending 404 response" << ENDL;
-  send_line(socket, "HTTP/1.0 404 Not Found");
-  send_line(socket, "Content-Length: 0");
-  send_line(socket, "Content-Type text/html");
-  send_line(socket, "");
+  conn.response().status = 404;
+  ResponseBuilder{conn.out, "404 Not Found"}
+      .header("Content-Length", "0")
+      .header("Content-Type", "text/html")
+      .connection(conn.connection_token())
+      .end();
 }
 
 // **************************************************************************
 // * Send the entire 400 response, header and body.
 // **************************************************************************
-void send400(wnet::Socket &socket) {
+void send400(Connection &conn) {
   INFO << "Sending 400 response" << ENDL;
-  send_line(socket, "HTTP/1.0 400 Bad Request");
-  send_line(socket, "Content-Length: 0");
-  send_line(socket, "Content-Type text/html");
-  send_line(socket, "");
+  conn.response().status = 400;
+  conn.keep_alive = false; // the rest of the input cannot be trusted
+  ResponseBuilder{conn.out, "400 Bad Request"}
+      .header("Content-Length", "0")
+      .header("Content-Type", "text/html")
+      .connection(conn.connection_token())
+      .end();
+}
+
+// **************************************************************************************
+// * fileHeader
+// * -- The status line and headers for a file, built from its metadata only.
+// *    Also used by the file cache to precompute full responses, which it
+// *    drops whenever the file changes, so the ETag (size and mtime) stays
+// *    current. The cache keeps one header per Connection token a response
+// *    can need (none, close, keep-alive).
+// **************************************************************************************
+using ETagBuffer = std::array<char, 64>;
+
+// the entity tag of one version of a file: size and mtime in hex, quoted
+std::string_view make_etag(const FileInfo &info, ETagBuffer &buffer) {
+  auto result = std::format_to_n(buffer.data(), buffer.size(),
+                                 "\"{:x}-{:x}-{:x}\"", info.size,
+                                 info.mtime.tv_sec, info.mtime.tv_nsec);
+  return {buffer.data(), result.out};
+}
+
+std::string file_header(const FileInfo &info, std::string_view connection) {
+  ETagBuffer etag;
+  std::string header;
+  ResponseBuilder{header, "200 OK"}
+      .header("Content-Length", "{}", info.size)
+      .header("Content-Type", "{}", info.content_type)
+      .header("ETag", "{}", make_etag(info, etag))
+      .connection(connection)
+      .end();
+  return header;
+}
+
+// **************************************************************************
+// * Send a 304 response: the client's copy (If-None-Match) is current.
+// **************************************************************************
+void send304(Connection &conn, const FileInfo &info) {
+  INFO << "Sending 304 response" << ENDL;
+  conn.response().status = 304;
+  ETagBuffer etag;
+  ResponseBuilder{conn.out, "304 Not Modified"}
+      .header("ETag", "{}", make_etag(info, etag))
+      .connection(conn.connection_token())
+      .end();
+}
+
+// **************************************************************************
+// * Send every worker's metrics (see metrics.h) in the Prometheus text
+// * format.
+// **************************************************************************
+constexpr std::string_view METRICS_PATH = "/metrics"; // never a data file
+
+void send_metrics(Connection &conn, bool include_body) {
+  INFO << "Sending metrics" << ENDL;
+  const std::string body = metrics::render();
+  ResponseBuilder{conn.out, "200 OK"}
+      .header("Content-Length", "{}", body.size())
+      .header("Content-Type", "text/plain; version=0.0.4")
+      .connection(conn.connection_token())
+      .end();
+  if (include_body) {
+    conn.out.append(body);
+  }
 }
 
 // **************************************************************************************
 // * sendFile
 // * -- Send a file back to the browser.
+// *    - A client that already has the current version (If-None-Match) gets
+// *      a 304 decided from cached metadata alone.
+// *    - Small hot files come from the cache as one precomputed response.
+// *    - Other files are opened and streamed with sendfile() by the engine.
+// *    - Without a body (HEAD) the file is never opened; the header comes from
+// *      the cache or from cached metadata.
 // **************************************************************************************
-void send_file(wnet::Socket &socket, std::string_view filename,
-               bool include_body = true) {
-  std::string parsed_fname{filename};
-  if (parsed_fname.starts_with('/')) {
-    parsed_fname = parsed_fname.substr(1);
+void send_file(Connection &conn, FileCache &files, const HttpRequest &request) {
+  const std::string_view filename = request.path;
+  const bool include_body = request.method != HttpRequestType::HEAD;
+  INFO << std::format("Attempting to give file: {}",
+                      files.resolve(filename).string())
+       << ENDL;
+
+  if (auto tags = request.header(HeaderId::IfNoneMatch); !tags.empty()) {
+    ETagBuffer etag;
+    auto info = files.info(filename);
+    if (info && etag_matches(tags, make_etag(*info, etag))) {
+      send304(conn, *info);
+      return;
+    }
   }
 
-  const std::filesystem::path fp = std::filesystem::path{"data"} / parsed_fname;
-  INFO << std::format("Attempting to give file: {}", fp.string()) << ENDL;
+  Response &response = conn.response();
+  const auto connection = conn.connection_token();
+  if (auto hit = files.response(filename, include_body)) {
+    if (connection.empty()) {
+      response.cached_bytes = include_body ? hit->full() : hit->header();
+    } else { // the variant with the Connection field, then the body
+      response.cached_header = hit->header(connection);
+      response.cached_bytes = include_body ? hit->body() : std::string_view{};
+    }
+    response.cached = std::move(hit);
+    metrics::local().cache_hits.add();
+    return;
+  }
+  metrics::local().cache_misses.add();
 
-  auto fcontent = read_file(fp);
-  if (!fcontent) {
-    send404(socket);
+  if (!include_body) {
+    auto info = files.info(filename);
+    if (!info) {
+      send404(conn);
+      return;
+    }
+    conn.out.append(file_header(*info, connection));
     return;
   }
 
-  const auto content_type = get_content_type(filename);
-  const auto content_length = fcontent->size();
+  auto file = files.open(filename);
+  if (!file) {
+    send404(conn);
+    return;
+  }
 
-  send_line(socket, "HTTP/1.0 200 OK");
-  send_line(socket, std::format("Content-Length: {}", content_length));
-  send_line(socket, std::format("Content-Type: {}", content_type));
-  send_line(socket, "");
+  conn.out.append(file_header(file->info, connection));
 
-  if (include_body && !fcontent->empty()) {
-    auto sent = socket.send(std::span{fcontent->data(), fcontent->size()});
-    if (!sent) {
-      ERROR << "Failed to send file content" << ENDL;
-    } else {
-      INFO << std::format("Successfully sent {} bytes", *sent) << ENDL;
-    }
+  if (file->info.size > 0) {
+    response.body_fd = std::move(file->fd); // sent after the header
+    response.body_size = file->info.size;
   }
 }
 
 // **************************************************************************************
 // * processConnection
-// * -- process one connection/request.
+// * -- process one request that has been fully read into the connection,
+// *    building its response in conn.response().
 // **************************************************************************************
 
-void process_connection(wnet::Socket &client, wnet::SocketAddr &client_addr) {
+void process_connection(Connection &conn, FileCache &files,
+                        const HttpRequest &request) {
   // Call readHeader()
 
   // If read header returned 400, send 400
@@ -261,51 +649,1098 @@ void process_connection(wnet::Socket &client, wnet::SocketAddr &client_addr) {
   // back the header.
   // - If the header was valid and the method was POST, call a function to save
   // the file to dis.
-  INFO << std::format("Processing connection from {}", client_addr.to_string())
+  INFO << std::format("Processing connection from {}", conn.addr.to_string())
+       << ENDL;
+  INFO << std::format("Successfully parsed request: {} {} {}",
+                      request.method_name, request.path, request.http_version)
        << ENDL;
 
-  auto request = read_header(client);
-  if (!request) {
-    send400(client);
+  conn.http11 = request.http_version == "HTTP/1.1";
+  conn.keep_alive = wants_keep_alive(request) && --conn.requests_left > 0;
+
+  const bool metrics_request = request.path == METRICS_PATH &&
+                               (request.method == HttpRequestType::GET ||
+                                request.method == HttpRequestType::HEAD);
+  const bool valid = metrics_request || is_valid_filename(request.path);
+  conn.response().timeline.routed = Connection::clock::now();
+
+  if (metrics_request) {
+    send_metrics(conn, request.method == HttpRequestType::GET);
     return;
   }
 
-  if (!is_valid_filename(request->path)) {
-    WARNING << std::format("Invalid filename requested: {}", request->path)
+  if (!valid) {
+    WARNING << std::format("Invalid filename requested: {}", request.path)
             << ENDL;
-    send404(client);
+    send404(conn);
     return;
   }
 
-  switch (request->method) {
+  switch (request.method) {
   case HttpRequestType::GET:
-    INFO << std::format("Processing GET request: {}", request->path) << ENDL;
-    send_file(client, request->path);
+    INFO << std::format("Processing GET request: {}", request.path) << ENDL;
+    send_file(conn, files, request);
     break;
   case HttpRequestType::HEAD:
-    INFO << std::format("Processing HEAD request: {}", request->path) << ENDL;
-    send_file(client, request->path, false);
+    INFO << std::format("Processing HEAD request: {}", request.path) << ENDL;
+    send_file(conn, files, request);
     break;
   case HttpRequestType::POST:
     INFO << "POST method not required" << ENDL;
-    send400(client);
+    send400(conn);
     break;
   case HttpRequestType::INVALID:
   default:
     WARNING << "INVALID or unsupported HTTP method" << ENDL;
-    send400(client);
+    send400(conn);
     break;
   }
 }
 
-std::optional<uint16_t> find_available_port(uint16_t start = 1024,
+// **************************************************************************************
+// * handleInput
+// * -- called by the event loops after bytes were appended to conn.in. A
+// *    response is queued for every complete request buffered (up to
+// *    MAX_PIPELINED, and none after one that closes the connection), so a
+// *    pipelined batch is answered with one write. Each request is consumed
+// *    as a whole, header and body, before the next one is parsed. true if anything was
+// *    queued; false means more input is needed.
+// **************************************************************************************
+bool handle_input(Connection &conn, FileCache &files) {
+  if (!conn.skip_body()) {
+    return false; // still inside the body of an answered request
+  }
+
+  std::size_t queued = 0;
+  while (queued < MAX_PIPELINED) {
+    const auto status = conn.parser.parse(conn.in.view());
+    if (status == RequestParser::Status::Incomplete) {
+      break;
+    }
+
+    conn.begin_response();
+    Timeline &timeline = conn.response().timeline;
+    timeline.parsed = Connection::clock::now();
+    if (status == RequestParser::Status::Complete) {
+      DEBUGL << std::format("Received request data:\n{}",
+                            conn.in.view().substr(0, conn.parser.size()))
+             << ENDL;
+      const HttpRequest &request = conn.parser.request();
+      conn.response().method = request.method;
+      if (conn.access_log != nullptr) {
+        conn.response().path_id = conn.access_log->intern(request.path);
+      }
+      process_connection(conn, files, request);
+    } else {
+      WARNING << (status == RequestParser::Status::TooLarge
+                      ? "Request header too large"
+                      : "Unable to parse request")
+              << ENDL;
+      send400(conn);
+    }
+    conn.end_response();
+    timeline.queued = Connection::clock::now();
+    if (timeline.routed == Connection::clock::time_point{}) {
+      timeline.routed = timeline.parsed; // rejected before routing
+    }
+    ++queued;
+
+    if (status != RequestParser::Status::Complete) {
+      break; // send400() closes the connection
+    }
+    conn.in.consume(conn.parser.size()); // anything after it stays buffered
+    conn.body_left = conn.parser.body_size();
+    conn.parser.reset();
+
+    if (!conn.keep_alive) {
+      break; // whatever follows is never answered
+    }
+    if (!conn.skip_body()) {
+      break; // the rest of the body is dropped as it arrives
+    }
+  }
+
+  return queued > 0;
+}
+
+// **************************************************************************************
+// * Server
+// * -- single threaded reactor. The listening socket and every client are
+// *    non-blocking and registered with wnet::Poll; each readiness event
+// *    advances that connection's state machine as far as it can without
+// *    blocking, so a slow client never stalls the others.
+// **************************************************************************************
+class Server {
+public:
+  Server(wnet::Socket listener, wnet::Poll::Backend backend, FileCache files,
+         KeepAlive keep_alive, bool quick_ack = false,
+         std::optional<accesslog::AccessLog> access_log = std::nullopt)
+      : _listener(std::move(listener)), _poll(backend),
+        _files(std::move(files)), _keep_alive(keep_alive),
+        _quick_ack(quick_ack), _access_log(std::move(access_log)) {}
+
+  [[nodiscard]] bool run();
+
+private:
+  void on_accept();
+  void on_client(int fd, short revents);
+  void on_readable(Connection &conn);
+  void on_writable(Connection &conn);
+  void on_lingering(Connection &conn);
+  [[nodiscard]] bool flush(Connection &conn);
+  void set_interest(Connection &conn, short events);
+  void close_idle();
+  void close_connection(int fd);
+  void resume_accept();
+  [[nodiscard]] accesslog::AccessLog *access_log() noexcept {
+    return _access_log ? &*_access_log : nullptr;
+  }
+
+  wnet::Socket _listener;
+  bool _accept_paused{false}; // out of fds, see warn_accept_paused()
+  wnet::Poll _poll;
+  FileCache _files;
+  KeepAlive _keep_alive;
+  bool _quick_ack; // TCP_QUICKACK does not carry over from the listener
+  std::optional<accesslog::AccessLog> _access_log;
+  std::unordered_map<int, Connection> _connections;
+};
+
+bool Server::run() {
+  if (!_listener.set_blocking(false)) {
+    FATAL << "Failed to make listening socket non-blocking" << ENDL;
+    return false;
+  }
+
+  _poll.add(_listener.fd(), POLLIN, [this](int, short) { on_accept(); });
+
+  if (_files.watch()) {
+    _poll.add(_files.watch_fd(), POLLIN,
+              [this](int, short) { _files.process_events(); });
+  } else {
+    WARNING << "Cannot watch data files, revalidating them periodically"
+            << ENDL;
+  }
+
+  auto next_sweep = Connection::clock::now() + IDLE_SWEEP_INTERVAL;
+  while (!shutdown_requested.load()) {
+    DEBUGL << std::format("Waiting for events on {} fds", _poll.size())
+           << ENDL;
+
+    const int ready = _poll.poll(IDLE_SWEEP_INTERVAL);
+    const int error = errno;
+    dump_if_requested();
+    if (ready < 0) {
+      if (error == EINTR) {
+        continue; // a signal arrived, re-check shutdown_requested
+      }
+      FATAL << std::format("poll() failed: {}", std::strerror(error)) << ENDL;
+      return false;
+    }
+
+    _poll.process_events();
+
+    if (Connection::clock::now() >= next_sweep) {
+      close_idle();
+      resume_accept(); // fds may have been freed elsewhere
+      sample_accept_queue(_listener);
+      next_sweep = Connection::clock::now() + IDLE_SWEEP_INTERVAL;
+    }
+  }
+
+  for (auto &[fd, conn] : _connections) {
+    _poll.remove(fd);
+    conn.finish_batch(); // logs requests still in progress
+  }
+  metrics::local().active_connections.add(
+      -static_cast<int64_t>(_connections.size()));
+  _connections.clear();
+  if (_files.watch_fd() >= 0) {
+    _poll.remove(_files.watch_fd());
+  }
+  return true;
+}
+
+// Drains the whole listen backlog: a burst of connections costs one wakeup,
+// and the backlog bounds how long this runs.
+void Server::on_accept() {
+  while (true) {
+    auto connection = _listener.accept(false);
+    if (!connection) {
+      const auto error = connection.error();
+      if (wnet::would_block(error) || shutdown_requested.load()) {
+        return;
+      }
+      if (error == std::errc::connection_aborted ||
+          error == std::errc::interrupted) {
+        continue; // that client gave up, others may be waiting
+      }
+      if (error == std::errc::too_many_files_open ||
+          error == std::errc::too_many_files_open_in_system) {
+        warn_accept_paused(wnet::error_message(error));
+        _poll.modify(_listener.fd(), 0);
+        _accept_paused = true;
+        return;
+      }
+      ERROR << std::format("Failed to accept connection: {}",
+                           wnet::error_message(error))
+            << ENDL;
+      return;
+    }
+
+    auto &[client_socket, client_addr] = *connection;
+    DEBUGL << std::format("Accepted connection from: {}",
+                          client_addr.to_string())
+           << ENDL;
+
+    if (_quick_ack && !client_socket.set_quick_ack(true)) {
+      DEBUGL << "Failed to set TCP_QUICKACK on client socket" << ENDL;
+    }
+
+    metrics::Shard &stats = metrics::local();
+    stats.connections_accepted.add();
+    stats.active_connections.add(1);
+
+    const int fd = client_socket.fd();
+    _connections.try_emplace(fd, std::move(client_socket),
+                             std::move(client_addr), _keep_alive.max_requests,
+                             access_log());
+    _poll.add(fd, POLLIN,
+              [this](int fd, short revents) { on_client(fd, revents); });
+  }
+}
+
+void Server::on_client(int fd, short revents) {
+  auto it = _connections.find(fd);
+  if (it == _connections.end()) {
+    return;
+  }
+  Connection &conn = it->second;
+
+  try {
+    if (revents & (POLLERR | POLLNVAL)) {
+      conn.state = Connection::State::Closing;
+    } else if (conn.state == Connection::State::ReadingHeader &&
+               (revents & (POLLIN | POLLHUP))) {
+      on_readable(conn);
+    } else if (conn.state == Connection::State::WritingResponse &&
+               (revents & POLLOUT)) {
+      on_writable(conn);
+    } else if (conn.state == Connection::State::Lingering &&
+               (revents & (POLLIN | POLLHUP))) {
+      on_lingering(conn);
+    }
+  } catch (const std::exception &e) {
+    ERROR << std::format("Failed to process connection: {}", e.what())
+          << ENDL;
+    conn.state = Connection::State::Closing;
+  }
+
+  if (conn.state == Connection::State::Closing) {
+    close_connection(fd);
+  }
+}
+
+void Server::on_readable(Connection &conn) {
+  while (true) {
+    auto received = conn.in.fill(conn.socket);
+    if (!received) {
+      if (!wnet::would_block(received.error())) {
+        ERROR << "Failed to receive request data" << ENDL;
+        conn.state = Connection::State::Closing;
+      }
+      return; // wait for the next POLLIN
+    }
+
+    if (*received == 0) { // peer closed, normally between two requests
+      conn.state = Connection::State::Closing;
+      return;
+    }
+    conn.received(*received);
+
+    if (handle_input(conn, _files)) {
+      break;
+    }
+  }
+
+  conn.state = Connection::State::WritingResponse;
+  on_writable(conn); // the socket is almost always writable right away
+}
+
+void Server::on_writable(Connection &conn) {
+  while (true) {
+    if (!flush(conn)) {
+      if (conn.state == Connection::State::WritingResponse) {
+        set_interest(conn, POLLOUT); // the socket buffer is full
+      }
+      return;
+    }
+
+    INFO << std::format("Successfully sent {} responses ({} bytes)",
+                        conn.responses.size(), conn.bytes_sent())
+         << ENDL;
+    if (!conn.responses.back().keep_alive) {
+      conn.linger();
+      set_interest(conn, POLLIN);
+      return;
+    }
+
+    conn.finish_batch();
+    conn.state = Connection::State::ReadingHeader;
+    if (!handle_input(conn, _files)) {
+      set_interest(conn, POLLIN);
+      return;
+    }
+    // more requests had already arrived; answer them right away
+    conn.state = Connection::State::WritingResponse;
+  }
+}
+
+// Drops whatever the client still sends; closes once it has closed too.
+void Server::on_lingering(Connection &conn) {
+  std::array<char, RECV_CHUNK_SIZE> discard;
+  while (true) {
+    auto received = conn.socket.recv(std::span{discard});
+    if (!received) {
+      if (!wnet::would_block(received.error())) {
+        conn.state = Connection::State::Closing;
+      }
+      return;
+    }
+    if (*received == 0) {
+      conn.state = Connection::State::Closing;
+      return;
+    }
+  }
+}
+
+// Writes as much of the queued batch as the socket takes. true once all of
+// it is sent; false if the socket is full (wait for POLLOUT) or failed.
+bool Server::flush(Connection &conn) {
+  std::array<iovec, IOV_BATCH> storage;
+  while (!conn.all_sent()) {
+    // everything in memory up to the next file body goes out in one
+    // sendmsg(); MSG_MORE lets the last header share a segment with the
+    // first bytes of that body
+    bool body_follows = false;
+    for (auto iov = conn.gather(storage, body_follows); !iov.empty();) {
+      auto sent = conn.socket.sendv(iov, body_follows);
+      if (!sent) {
+        if (!wnet::would_block(sent.error())) {
+          ERROR << "Failed to send response" << ENDL;
+          conn.state = Connection::State::Closing;
+        }
+        return false; // wait for the next POLLOUT
+      }
+      conn.advance(*sent);
+    }
+
+    while (Response *r = conn.body_to_send()) {
+      const std::size_t body_sent = r->sent - r->in_memory();
+      auto sent = conn.socket.send_file(r->body_fd.get(),
+                                        static_cast<off_t>(body_sent),
+                                        r->body_size - body_sent);
+      if (!sent) {
+        if (!wnet::would_block(sent.error())) {
+          ERROR << "Failed to send file content" << ENDL;
+          conn.state = Connection::State::Closing;
+        }
+        return false;
+      }
+      if (*sent == 0) { // the file shrank underneath us
+        ERROR << "Unexpected end of file while sending" << ENDL;
+        conn.state = Connection::State::Closing;
+        return false;
+      }
+      conn.advance_body(*sent);
+    }
+  }
+
+  return true;
+}
+
+// Only touches the kernel's interest list when it actually changes, so a
+// response that fits the socket buffer costs no epoll_ctl() at all.
+void Server::set_interest(Connection &conn, short events) {
+  if (conn.interest != events) {
+    _poll.modify(conn.socket.fd(), events);
+    conn.interest = events;
+  }
+}
+
+// Closes connections that made no progress within the idle timeout: kept
+// alive but silent, stuck half way through a header, or not reading. Also
+// ends lingering that has gone on for LINGER_TIMEOUT.
+void Server::close_idle() {
+  const auto now = Connection::clock::now();
+  std::vector<int> idle;
+  for (const auto &[fd, conn] : _connections) {
+    if (conn.timed_out(now, _keep_alive)) {
+      idle.push_back(fd);
+    }
+  }
+
+  for (int fd : idle) {
+    DEBUGL << "Closing idle connection" << ENDL;
+    close_connection(fd);
+  }
+}
+
+void Server::close_connection(int fd) {
+  _poll.remove(fd);
+  if (auto it = _connections.find(fd); it != _connections.end()) {
+    it->second.finish_batch(); // logs responses the client did not get
+    _connections.erase(it);    // closes the socket
+    metrics::local().active_connections.add(-1);
+    resume_accept();
+  }
+  DEBUGL << "Connection processed and closed" << ENDL;
+}
+
+void Server::resume_accept() {
+  if (_accept_paused) {
+    _poll.modify(_listener.fd(), POLLIN);
+    _accept_paused = false;
+  }
+}
+
+// **************************************************************************************
+// * UringServer
+// * -- completion based alternative to Server. One multishot accept and one
+// *    multishot recv per client (into kernel-selected provided buffers) stay
+// *    armed; sends and file reads are queued on the ring and the whole batch
+// *    is submitted with a single io_uring_enter() per loop iteration. A file
+// *    body goes out BODY_CHUNK_SIZE at a time, each chunk read into a buffer
+// *    of the connection and sent from there before the next is read. File
+// *    change notifications for the cache arrive as one more read.
+// *
+// *    A connection is only destroyed once none of its operations are still in
+// *    flight. Closing shuts the socket down and cancels everything on it, so
+// *    that normally happens at once; one still stuck after CLOSE_TIMEOUT is
+// *    dropped anyway, and its late completions are told apart from those of
+// *    a connection that reuses the fd by the generation in their user_data.
+// *    Not while a send or file read is in flight, though: the kernel may
+// *    still use the connection's buffers, so that one is cancelled again
+// *    and waited for.
+// **************************************************************************************
+constexpr uint16_t RECV_BUFFER_GROUP = 0;
+constexpr uint16_t RECV_BUFFER_COUNT = 256;
+constexpr std::chrono::seconds CLOSE_TIMEOUT{5};
+// input buffered while a batch is written, beyond which receiving pauses
+constexpr std::size_t MAX_BUFFERED_INPUT = MAX_HEADER_SIZE * MAX_PIPELINED;
+// file body bytes a connection holds at once
+constexpr std::size_t BODY_CHUNK_SIZE = 64 * 1024;
+
+class UringServer {
+public:
+  UringServer(wnet::Socket listener, wnet::Uring ring, FileCache files,
+              KeepAlive keep_alive, bool quick_ack = false,
+              std::optional<accesslog::AccessLog> access_log = std::nullopt)
+      : _listener(std::move(listener)), _files(std::move(files)),
+        _keep_alive(keep_alive), _quick_ack(quick_ack),
+        _access_log(std::move(access_log)), _ring(std::move(ring)) {}
+
+  [[nodiscard]] bool run();
+
+private:
+  enum class Op : uint8_t { Accept, Recv, Send, Read, Cancel, Watch };
+
+  struct Slot {
+    Slot(Connection c, uint32_t g) : conn(std::move(c)), generation(g) {}
+
+    Connection conn;
+    uint32_t generation;  // of the fd, in the user_data of its operations
+    unsigned inflight{0}; // submitted operations without a final completion
+    bool recv_armed{false};
+    bool recv_paused{false}; // conn.in is full until the batch is out
+    bool peer_closed{false}; // got EOF mid-batch; recv is not re-armed
+    bool read_armed{false}; // a body chunk is being read into `chunk`
+    bool send_armed{false}; // from `msg` (and the batch) or `chunk`
+    bool cancel_sent{false};
+    Connection::clock::time_point closing_since;
+    std::array<iovec, IOV_BATCH> iov; // the in-flight sendmsg()
+    msghdr msg{};
+    std::unique_ptr<char[]> chunk; // BODY_CHUNK_SIZE, allocated on first use
+    std::span<const char> chunk_unsent; // read into `chunk`, not yet sent
+  };
+
+  // generation (24 bits) | op (8 bits) | fd (32 bits)
+  static uint64_t user_data(Op op, int fd, uint32_t generation = 0) noexcept {
+    return (static_cast<uint64_t>(generation) << 40) |
+           (static_cast<uint64_t>(op) << 32) | static_cast<uint32_t>(fd);
+  }
+
+  void arm_accept();
+  void arm_watch();
+  void arm_recv(int fd, Slot &slot);
+  void update_recv(int fd, Slot &slot);
+  void continue_response(int fd, Slot &slot);
+  void submit_send(int fd, Slot &slot);
+
+  void on_accept(const wnet::Uring::Completion &c);
+  void on_watch(const wnet::Uring::Completion &c);
+  void on_recv(int fd, Slot &slot, const wnet::Uring::Completion &c);
+  void on_read(int fd, Slot &slot, const wnet::Uring::Completion &c);
+  void on_send(int fd, Slot &slot, const wnet::Uring::Completion &c);
+  void start_response(int fd, Slot &slot);
+  void close_idle();
+  void close_connection(int fd, Slot &slot);
+  void resume_accept();
+  [[nodiscard]] accesslog::AccessLog *access_log() noexcept {
+    return _access_log ? &*_access_log : nullptr;
+  }
+
+  wnet::Socket _listener;
+  FileCache _files;
+  KeepAlive _keep_alive;
+  bool _quick_ack;
+  std::optional<accesslog::AccessLog> _access_log;
+  std::unordered_map<int, Slot> _connections;
+  std::array<char, FileCache::EVENT_BUFFER_SIZE> _file_events;
+  wnet::Uring _ring; // destroyed first, while buffers it may use still exist
+  bool _multishot_accept{true};
+  bool _multishot_recv{true};
+  bool _accept_paused{false}; // out of fds, see warn_accept_paused()
+  uint32_t _next_generation{0};
+};
+
+bool UringServer::run() {
+  arm_accept();
+
+  if (_files.watch()) {
+    arm_watch();
+  } else {
+    WARNING << "Cannot watch data files, revalidating them periodically"
+            << ENDL;
+  }
+
+  auto next_sweep = Connection::clock::now() + IDLE_SWEEP_INTERVAL;
+  while (!shutdown_requested.load()) {
+    if (Connection::clock::now() >= next_sweep) {
+      close_idle();
+      resume_accept(); // fds may have been freed elsewhere
+      sample_accept_queue(_listener);
+      next_sweep = Connection::clock::now() + IDLE_SWEEP_INTERVAL;
+    }
+
+    int ret = _ring.submit_and_wait(1, IDLE_SWEEP_INTERVAL);
+    dump_if_requested();
+    if (ret == -ETIME) {
+      continue; // nothing completed before the sweep is due
+    }
+    // on a signal, or when the kernel needs the CQ reaped before it takes more
+    // (EBUSY) or is short of memory (EAGAIN), whatever has completed is still
+    // reaped below, otherwise an overflowed CQ would never drain
+    if (ret < 0 && ret != -EINTR && ret != -EAGAIN && ret != -EBUSY) {
+      FATAL << std::format("io_uring_enter() failed: {}", std::strerror(-ret))
+            << ENDL;
+      return false;
+    }
+
+    for (const auto &c : _ring.reap()) {
+      const auto op = static_cast<Op>((c.user_data >> 32) & 0xff);
+      const int fd = static_cast<int>(c.user_data & 0xffffffff);
+      const auto generation = static_cast<uint32_t>(c.user_data >> 40);
+
+      if (op == Op::Accept) {
+        on_accept(c);
+        continue;
+      }
+      if (op == Op::Watch) {
+        on_watch(c);
+        continue;
+      }
+
+      auto it = _connections.find(fd);
+      if (it == _connections.end() || it->second.generation != generation) {
+        if (auto bid = c.buffer_id()) { // of a connection dropped by force
+          _ring.recycle_buffer(*bid);
+        }
+        continue;
+      }
+      Slot &slot = it->second;
+
+      try {
+        switch (op) {
+        case Op::Recv:
+          on_recv(fd, slot, c);
+          break;
+        case Op::Read:
+          on_read(fd, slot, c);
+          break;
+        case Op::Send:
+          on_send(fd, slot, c);
+          break;
+        case Op::Cancel:
+        case Op::Accept:
+        case Op::Watch:
+          --slot.inflight;
+          break;
+        }
+      } catch (const std::exception &e) {
+        ERROR << std::format("Failed to process connection: {}", e.what())
+              << ENDL;
+        slot.conn.state = Connection::State::Closing;
+      }
+
+      if (slot.conn.state == Connection::State::Closing) {
+        close_connection(fd, slot);
+      }
+    }
+  }
+
+  for (auto &[fd, slot] : _connections) {
+    slot.conn.finish_batch(); // logs requests still in progress
+  }
+  metrics::local().active_connections.add(
+      -static_cast<int64_t>(_connections.size()));
+  return true;
+}
+
+void UringServer::arm_accept() {
+  _ring.prep_accept(_listener.fd(), user_data(Op::Accept, _listener.fd()),
+                    _multishot_accept);
+}
+
+void UringServer::arm_watch() {
+  // offset -1: a plain read() at the current position of a non-seekable fd
+  _ring.prep_read(_files.watch_fd(), _file_events, static_cast<uint64_t>(-1),
+                  user_data(Op::Watch, _files.watch_fd()));
+}
+
+void UringServer::arm_recv(int fd, Slot &slot) {
+  _ring.prep_recv(fd, RECV_BUFFER_GROUP,
+                  user_data(Op::Recv, fd, slot.generation), _multishot_recv);
+  ++slot.inflight;
+  slot.recv_armed = true;
+}
+
+// Pauses receiving while a batch is written and the client has already sent
+// MAX_BUFFERED_INPUT ahead, so one that pipelines without reading cannot grow
+// conn.in without bound, and resumes once there is room again.
+void UringServer::update_recv(int fd, Slot &slot) {
+  const Connection &conn = slot.conn;
+  const bool full = conn.state == Connection::State::WritingResponse &&
+                    conn.in.size() >= MAX_BUFFERED_INPUT;
+  if (full && !slot.recv_paused) {
+    slot.recv_paused = true;
+    if (slot.recv_armed) {
+      _ring.prep_cancel(user_data(Op::Recv, fd, slot.generation),
+                        user_data(Op::Cancel, fd, slot.generation));
+      ++slot.inflight;
+    }
+  } else if (!full) {
+    slot.recv_paused = false;
+    if (!slot.recv_armed && !slot.peer_closed &&
+        conn.state != Connection::State::Closing) {
+      arm_recv(fd, slot);
+    }
+  }
+}
+
+// Queues the next step of the batch: reading the next chunk of the file
+// body that is due, or else sending what is in memory.
+void UringServer::continue_response(int fd, Slot &slot) {
+  Response *r = slot.chunk_unsent.empty() ? slot.conn.body_to_send() : nullptr;
+  if (r == nullptr) {
+    submit_send(fd, slot);
+    return;
+  }
+
+  if (!slot.chunk) {
+    slot.chunk = std::make_unique_for_overwrite<char[]>(BODY_CHUNK_SIZE);
+  }
+  const std::size_t body_sent = r->sent - r->in_memory();
+  const std::size_t length =
+      std::min(BODY_CHUNK_SIZE, r->body_size - body_sent);
+  _ring.prep_read(r->body_fd.get(), std::span{slot.chunk.get(), length},
+                  body_sent, user_data(Op::Read, fd, slot.generation));
+  ++slot.inflight;
+  slot.read_armed = true;
+}
+
+// Sends the rest of the chunk that was read in, if any; otherwise the
+// in-memory bytes of the batch up to the next file body in one sendmsg(),
+// MSG_MORE letting the last header share a segment with that body.
+void UringServer::submit_send(int fd, Slot &slot) {
+  if (!slot.chunk_unsent.empty()) {
+    _ring.prep_send(fd, slot.chunk_unsent,
+                    user_data(Op::Send, fd, slot.generation));
+    ++slot.inflight;
+    slot.send_armed = true;
+    return;
+  }
+
+  bool body_follows = false;
+  auto iov = slot.conn.gather(slot.iov, body_follows);
+  slot.msg = msghdr{};
+  slot.msg.msg_iov = iov.data();
+  slot.msg.msg_iovlen = iov.size();
+  _ring.prep_sendmsg(fd, &slot.msg, user_data(Op::Send, fd, slot.generation),
+                     body_follows);
+  ++slot.inflight;
+  slot.send_armed = true;
+}
+
+void UringServer::on_accept(const wnet::Uring::Completion &c) {
+  if (c.res == -EINVAL && _multishot_accept) {
+    WARNING << "Multishot accept unsupported, re-arming per connection" << ENDL;
+    _multishot_accept = false;
+    arm_accept();
+    return;
+  }
+
+  if ((c.res == -EMFILE || c.res == -ENFILE) && !c.more()) {
+    warn_accept_paused(std::strerror(-c.res));
+    _accept_paused = true; // re-armed by resume_accept()
+    return;
+  }
+
+  if (!c.more() && !shutdown_requested.load()) {
+    arm_accept();
+  }
+
+  if (c.res < 0) {
+    ERROR << std::format("Failed to accept connection: {}",
+                         std::strerror(-c.res))
+          << ENDL;
+    return;
+  }
+
+  const int fd = c.res;
+  auto client_socket =
+      wnet::Socket::adopt(fd, wnet::Socket::State::Connect,
+                          _listener.type(), _listener.family());
+  if (_quick_ack && !client_socket.set_quick_ack(true)) {
+    DEBUGL << "Failed to set TCP_QUICKACK on client socket" << ENDL;
+  }
+  auto client_addr = client_socket.remote_addr().value_or(wnet::SocketAddr{});
+  DEBUGL << std::format("Accepted connection from: {}", client_addr.to_string())
+         << ENDL;
+
+  metrics::Shard &stats = metrics::local();
+  stats.connections_accepted.add();
+  stats.active_connections.add(1);
+
+  _next_generation = (_next_generation + 1) & 0xffffff;
+  auto [it, _] = _connections.try_emplace(
+      fd,
+      Connection{std::move(client_socket), std::move(client_addr),
+                 _keep_alive.max_requests, access_log()},
+      _next_generation);
+  arm_recv(fd, it->second);
+}
+
+void UringServer::on_watch(const wnet::Uring::Completion &c) {
+  if (c.res > 0) {
+    _files.apply_events(
+        std::span{_file_events}.first(static_cast<std::size_t>(c.res)));
+  } else if (c.res != -EINTR && c.res != -EAGAIN) {
+    ERROR << std::format("Cannot read file change notifications: {}",
+                         std::strerror(-c.res))
+          << ENDL;
+    _files.stop_watching();
+    return;
+  }
+
+  if (_files.watching() && !shutdown_requested.load()) {
+    arm_watch();
+  }
+}
+
+void UringServer::on_recv(int fd, Slot &slot, const wnet::Uring::Completion &c) {
+  Connection &conn = slot.conn;
+  if (!c.more()) {
+    --slot.inflight;
+    slot.recv_armed = false;
+  }
+
+  if (auto bid = c.buffer_id()) {
+    // input that arrives while a response is being written is the next
+    // request on a persistent connection; keep it for later
+    if (c.res > 0 && (conn.state == Connection::State::ReadingHeader ||
+                      conn.state == Connection::State::WritingResponse)) {
+      auto data = _ring.buffer(*bid, static_cast<std::size_t>(c.res));
+      conn.in.append(data);
+      conn.received(data.size());
+    }
+    _ring.recycle_buffer(*bid); // copied out, the kernel may reuse it
+  }
+
+  if (c.res == -EINVAL && _multishot_recv && !slot.recv_armed) {
+    WARNING << "Multishot recv unsupported, re-arming per read" << ENDL;
+    _multishot_recv = false;
+  } else if (c.res == -ENOBUFS) {
+    // every provided buffer is in use; retry once some are recycled
+  } else if (c.res == -ECANCELED && !slot.cancel_sent) {
+    // paused by update_recv()
+  } else if (c.res == 0 &&
+             conn.state == Connection::State::WritingResponse) {
+    // a client that shut down its sending side still wants the answers to
+    // what it sent; on_send() closes once they are out
+    slot.peer_closed = true;
+    return;
+  } else if (c.res < 0 || c.res == 0) { // error, cancelled or peer closed
+    if (c.res < 0 && c.res != -ECANCELED) {
+      ERROR << std::format("Failed to receive request data: {}",
+                           std::strerror(-c.res))
+            << ENDL;
+    }
+    conn.state = Connection::State::Closing;
+    return;
+  } else if (conn.state == Connection::State::ReadingHeader &&
+             handle_input(conn, _files)) {
+    start_response(fd, slot);
+  }
+
+  update_recv(fd, slot);
+}
+
+void UringServer::start_response(int fd, Slot &slot) {
+  slot.conn.state = Connection::State::WritingResponse;
+  continue_response(fd, slot);
+}
+
+void UringServer::on_read(int fd, Slot &slot, const wnet::Uring::Completion &c) {
+  Connection &conn = slot.conn;
+  --slot.inflight;
+  slot.read_armed = false;
+  if (conn.state == Connection::State::Closing) {
+    return; // a late completion; run() finishes closing
+  }
+
+  if (c.res <= 0) { // error, or the file shrank underneath us
+    ERROR << std::format("Failed to read file: {}",
+                         c.res < 0 ? std::strerror(-c.res) : "unexpected EOF")
+          << ENDL;
+    conn.state = Connection::State::Closing;
+    return;
+  }
+
+  slot.chunk_unsent = {slot.chunk.get(), static_cast<std::size_t>(c.res)};
+  submit_send(fd, slot);
+}
+
+void UringServer::on_send(int fd, Slot &slot, const wnet::Uring::Completion &c) {
+  Connection &conn = slot.conn;
+  --slot.inflight;
+  slot.send_armed = false;
+  if (conn.state == Connection::State::Closing) {
+    return; // a late completion; run() finishes closing
+  }
+
+  if (c.res < 0) {
+    ERROR << std::format("Failed to send response: {}", std::strerror(-c.res))
+          << ENDL;
+    conn.state = Connection::State::Closing;
+    return;
+  }
+
+  const auto sent = static_cast<std::size_t>(c.res);
+  if (!slot.chunk_unsent.empty()) {
+    conn.advance_body(sent);
+    slot.chunk_unsent = slot.chunk_unsent.subspan(sent);
+  } else {
+    conn.advance(sent);
+  }
+  if (!conn.all_sent()) {
+    continue_response(fd, slot);
+    return;
+  }
+
+  INFO << std::format("Successfully sent {} responses ({} bytes)",
+                      conn.responses.size(), conn.bytes_sent())
+       << ENDL;
+  if (!conn.responses.back().keep_alive) {
+    if (slot.peer_closed) { // nothing left to linger for
+      conn.state = Connection::State::Closing;
+      return;
+    }
+    conn.linger();
+    update_recv(fd, slot); // stays armed to drop what the client still sends
+    return;
+  }
+
+  conn.finish_batch();
+  conn.state = Connection::State::ReadingHeader;
+  if (handle_input(conn, _files)) { // more requests had already arrived
+    start_response(fd, slot);
+  } else if (slot.peer_closed) { // and no more will
+    conn.state = Connection::State::Closing;
+    return;
+  }
+  update_recv(fd, slot);
+}
+
+void UringServer::close_idle() {
+  const auto now = Connection::clock::now();
+  std::vector<int> idle, stuck;
+  for (const auto &[fd, slot] : _connections) {
+    if (slot.conn.state != Connection::State::Closing) {
+      if (slot.conn.timed_out(now, _keep_alive)) {
+        idle.push_back(fd);
+      }
+    } else if (slot.closing_since < now - CLOSE_TIMEOUT) {
+      stuck.push_back(fd);
+    }
+  }
+
+  for (int fd : idle) {
+    DEBUGL << "Closing idle connection" << ENDL;
+    Slot &slot = _connections.at(fd);
+    slot.conn.state = Connection::State::Closing;
+    close_connection(fd, slot);
+  }
+
+  for (int fd : stuck) {
+    Slot &slot = _connections.at(fd);
+    if (slot.read_armed || slot.send_armed) {
+      // the kernel may still write into slot.chunk or read the batch through
+      // slot.msg; ask again and keep the slot until the operation completes
+      const Op op = slot.read_armed ? Op::Read : Op::Send;
+      _ring.prep_cancel(user_data(op, fd, slot.generation),
+                        user_data(Op::Cancel, fd, slot.generation));
+      ++slot.inflight;
+      continue;
+    }
+    WARNING << std::format("Dropping a closed connection with {} operations "
+                           "still in flight",
+                           slot.inflight)
+            << ENDL;
+    slot.inflight = 0; // their completions no longer match its generation
+    close_connection(fd, slot);
+  }
+}
+
+void UringServer::close_connection(int fd, Slot &slot) {
+  if (!slot.cancel_sent) {
+    // a sendmsg() to a client that stopped reading would never complete:
+    // shutting the socket down fails whatever is waiting on it, and the
+    // cancel takes out what has not started yet
+    (void)slot.conn.socket.shutdown();
+    _ring.prep_cancel_fd(fd, user_data(Op::Cancel, fd, slot.generation));
+    ++slot.inflight;
+    slot.cancel_sent = true;
+    slot.closing_since = Connection::clock::now();
+  }
+
+  if (slot.inflight == 0) {
+    slot.conn.finish_batch(); // logs responses the client did not get
+    _connections.erase(fd);   // closes the socket
+    metrics::local().active_connections.add(-1);
+    DEBUGL << "Connection processed and closed" << ENDL;
+    resume_accept();
+  }
+}
+
+void UringServer::resume_accept() {
+  if (_accept_paused && !shutdown_requested.load()) {
+    _accept_paused = false;
+    arm_accept();
+  }
+}
+
+// **************************************************************************************
+// * Workers
+// * -- every worker owns a listening socket bound to the shared port with
+// *    SO_REUSEPORT, its own engine and its own FileCache, so workers share
+// *    no state: the kernel spreads new connections over the listeners and a
+// *    connection stays on one thread from accept to close.
+// **************************************************************************************
+struct EngineConfig {
+  wnet::Poll::Backend poll_backend{wnet::Poll::default_backend()};
+  bool use_uring{false};
+  std::size_t cache_budget{FileCache::DEFAULT_BUDGET}; // per worker
+  KeepAlive keep_alive;
+  bool quick_ack{false};
+  std::string access_log; // file prefix, empty for none
+};
+
+bool serve(std::size_t worker, wnet::Socket listener,
+           const EngineConfig &config) {
+  std::optional<accesslog::AccessLog> access_log;
+  if (!config.access_log.empty()) {
+    const auto path = accesslog::worker_file(config.access_log, worker);
+    auto opened =
+        accesslog::AccessLog::open(path, static_cast<uint32_t>(worker));
+    if (!opened) {
+      FATAL << std::format("Failed to open access log {}: {}", path.string(),
+                           wnet::error_message(opened.error()))
+            << ENDL;
+      return false;
+    }
+    access_log = std::move(*opened);
+  }
+
+  if (config.use_uring) {
+    auto ring = wnet::Uring::create();
+    if (ring && ring->setup_buffers(RECV_BUFFER_GROUP, RECV_BUFFER_COUNT,
+                                    RECV_CHUNK_SIZE)) {
+      INFO << std::format("Worker {} using io_uring engine", worker) << ENDL;
+      UringServer server(std::move(listener), std::move(*ring),
+                         FileCache{"data", file_header, config.cache_budget},
+                         config.keep_alive, config.quick_ack,
+                         std::move(access_log));
+      return server.run();
+    }
+    WARNING << std::format(
+                   "Worker {}: io_uring unavailable, falling back to the poll "
+                   "engine",
+                   worker)
+            << ENDL;
+  }
+
+  Server server(std::move(listener), config.poll_backend,
+                FileCache{"data", file_header, config.cache_budget},
+                config.keep_alive, config.quick_ack, std::move(access_log));
+  return server.run();
+}
+
+// Runs one worker per listener and waits for all of them. A worker that
+// fails brings the others down with it.
+bool run_workers(std::vector<wnet::Socket> listeners,
+                 const EngineConfig &config) {
+  if (listeners.size() == 1) {
+    return serve(0, std::move(listeners.front()), config);
+  }
+
+  // Workers are started with the shutdown signals blocked so they are
+  // delivered to this thread, which does nothing but wait; each worker notices
+  // shutdown_requested within one IDLE_SWEEP_INTERVAL.
+  sigset_t signals, previous;
+  sigemptyset(&signals);
+  sigaddset(&signals, SIGINT);
+  sigaddset(&signals, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &signals, &previous);
+
+  std::atomic_bool failed{false};
+  std::vector<std::thread> workers;
+  workers.reserve(listeners.size());
+  for (std::size_t i = 0; i < listeners.size(); ++i) {
+    workers.emplace_back([&, i, listener = std::move(listeners[i])]() mutable {
+      if (!serve(i, std::move(listener), config)) {
+        failed.store(true);
+        shutdown_requested.store(true);
+      }
+    });
+  }
+
+  pthread_sigmask(SIG_SETMASK, &previous, nullptr);
+  for (auto &worker : workers) {
+    worker.join();
+  }
+  return !failed.load();
+}
+
+std::optional<uint16_t> find_available_port(std::string_view address,
+                                            uint16_t start = 1024,
                                             std::size_t max_attempts = 100) {
   std::random_device rd;
   std::mt19937 gen(rd());
   std::uniform_int_distribution<uint16_t> dist(1024, 65535);
 
   auto test_sock = wnet::Socket::create_bind(
-      wnet::SocketAddr{wnet::SocketAddr::LOCALHOST, start});
+      wnet::SocketAddr{address, start});
   if (test_sock) {
     return start;
   }
@@ -313,7 +1748,7 @@ std::optional<uint16_t> find_available_port(uint16_t start = 1024,
   for (std::size_t attempt = 0; attempt < max_attempts; ++attempt) {
     uint16_t port = dist(gen);
     auto test_sock = wnet::Socket::create_bind(
-        wnet::SocketAddr{wnet::SocketAddr::LOCALHOST, port});
+        wnet::SocketAddr{address, port});
     if (test_sock) {
       return port;
     }
@@ -327,81 +1762,171 @@ int main(int argc, char *argv[]) {
   // ********************************************************************
   // * Process the command line arguments
   // ********************************************************************
+  EngineConfig config;
+  std::size_t cache_budget = FileCache::DEFAULT_BUDGET;
+  std::size_t worker_count =
+      std::max(1U, std::thread::hardware_concurrency());
+  std::string address = wnet::SocketAddr::LOCALHOST;
+  wnet::SocketOptions listen_options;
+  listen_options.reuse_port = true; // one listener per worker, same port
+
   int opt;
-  while ((opt = getopt(argc, argv, "d:")) != -1) {
+  while ((opt = getopt(argc, argv, "d:b:uc:k:m:t:D:F:QP:L:NS:R:a:A:")) != -1) {
     switch (opt) {
     case 'd':
       LOG_LEVEL = std::stoi(optarg);
       break;
+    case 'b':
+      if (std::string_view{optarg} == "poll") {
+        config.poll_backend = wnet::Poll::Backend::Poll;
+      } else if (std::string_view{optarg} == "epoll") {
+        config.poll_backend = wnet::Poll::Backend::Epoll;
+      } else {
+        std::cout << std::format("Unknown event backend: {}\n", optarg);
+        return -1;
+      }
+      break;
+    case 'u':
+      config.use_uring = true;
+      break;
+    case 'c':
+      cache_budget = std::stoull(optarg);
+      break;
+    case 'k':
+      config.keep_alive.idle_timeout =
+          std::chrono::seconds(std::stoul(optarg));
+      break;
+    case 'm':
+      config.keep_alive.max_requests = std::max(1UL, std::stoul(optarg));
+      break;
+    case 't':
+      worker_count = std::max(1UL, std::stoul(optarg));
+      break;
+    case 'D':
+      listen_options.defer_accept = std::chrono::seconds(std::stoul(optarg));
+      break;
+    case 'F':
+      listen_options.fast_open = std::stoi(optarg);
+      break;
+    case 'Q':
+      config.quick_ack = true; // applied to each accepted socket
+      break;
+    case 'P':
+      listen_options.busy_poll = std::chrono::microseconds(std::stoul(optarg));
+      break;
+    case 'L':
+      listen_options.notsent_lowat = std::stoi(optarg);
+      break;
+    // these three are set on the listeners and inherited by accepted sockets;
+    // buffer sizes go in before listen() so the window scale can use them
+    case 'N':
+      listen_options.no_delay = true;
+      break;
+    case 'S':
+      listen_options.send_buffer_size = std::stoi(optarg);
+      break;
+    case 'R':
+      listen_options.recv_buffer_size = std::stoi(optarg);
+      break;
+    case 'a':
+      address = optarg; // "::" listens on IPv6 and IPv4
+      break;
+    case 'A':
+      config.access_log = optarg; // worker N writes <prefix>.N.bin
+      break;
     case ':':
     case '?':
     default:
-      std::cout << std::format("Usage: {} -d LOG_LEVEL\n", argv[0]);
+      std::cout << std::format(
+          "Usage: {} -d LOG_LEVEL [-b poll|epoll] [-u] [-c CACHE_BYTES] "
+          "[-k IDLE_SECONDS] [-m MAX_REQUESTS] [-t THREADS]\n"
+          "       [-D DEFER_ACCEPT_SECONDS] [-F FASTOPEN_QUEUE] [-Q] "
+          "[-P BUSY_POLL_USEC] [-L NOTSENT_LOWAT_BYTES] [-N]\n"
+          "       [-S SNDBUF_BYTES] [-R RCVBUF_BYTES] [-a ADDRESS] "
+          "[-A ACCESS_LOG_PREFIX]\n",
+          argv[0]);
       return -1;
     }
   }
 
+  if (LOG_LEVEL > LOG_COMPILED_LEVEL) {
+    WARNING << std::format("Log level {} requested, but this build only "
+                           "logs up to level {}",
+                           LOG_LEVEL, LOG_COMPILED_LEVEL)
+            << ENDL;
+  }
+
   // *******************************************************************
   // * Catch all possible signals
   // ********************************************************************
   DEBUGL << "Setting up signal handlers" << ENDL;
   std::signal(SIGINT, sig_handler);
   std::signal(SIGTERM, sig_handler);
+  std::signal(SIGUSR1, dump_handler);
 
   // *******************************************************************
   // * Creating the inital socket using the socket() call.
   // ********************************************************************
-  auto port = find_available_port();
+  try {
+    (void)wnet::SocketAddr{address, 0};
+  } catch (const std::invalid_argument &e) {
+    FATAL << e.what() << ENDL;
+    return -1;
+  }
+
+  auto port = find_available_port(address);
   if (!port) {
     FATAL << "could not find available port to start server" << ENDL;
     exit(-1);
   }
 
-  INFO << std::format("Attempting to bind to port: {}", *port) << ENDL;
-  auto server_socket = wnet::Socket::create_bind(
-      wnet::SocketAddr{wnet::SocketAddr::LOCALHOST, *port});
-
-  if (!server_socket) {
-    FATAL << std::format("Failed to create and bind socket on port: {}", *port)
-          << ENDL;
-    return -1;
-  }
+  // the cache budget is shared out between the workers' caches
+  config.cache_budget = cache_budget / worker_count;
 
-  if (!server_socket->listen()) {
-    FATAL << "Failed to listen on socket" << ENDL;
-    return -1;
-  }
-  INFO << std::format("Server listening on {}:{}", wnet::SocketAddr::LOCALHOST,
-                      *port)
+  INFO << std::format("Attempting to bind {} listeners to port: {}",
+                      worker_count, *port)
        << ENDL;
+  const wnet::SocketAddr listen_addr{address, *port};
+  std::vector<wnet::Socket> listeners;
+  listeners.reserve(worker_count);
+  for (std::size_t i = 0; i < worker_count; ++i) {
+    auto server_socket =
+        wnet::Socket::create(wnet::Socket::Type::TCP, listen_addr.family());
+    if (!server_socket) {
+      FATAL << "Failed to create socket" << ENDL;
+      return -1;
+    }
 
-  while (!shutdown_requested.load()) {
-    DEBUGL << "Waiting for connection" << ENDL;
+    if (auto result = server_socket->set_options(listen_options); !result) {
+      FATAL << std::format("Failed to set listening socket options: {}",
+                           wnet::error_message(result.error()))
+            << ENDL;
+      return -1;
+    }
 
-    auto connection = server_socket->accept();
-    if (!connection) {
-      if (!shutdown_requested.load()) {
-        ERROR << "Failed to accept connection" << ENDL;
-      }
-      continue;
+    if (!server_socket->bind(listen_addr)) {
+      FATAL << std::format("Failed to bind socket on port: {}", *port) << ENDL;
+      return -1;
     }
 
-    auto &[client_socket, client_addr] = *connection;
-    DEBUGL << std::format("Accepted connection from: {}",
-                          client_addr.to_string())
-           << ENDL;
-    try {
-      process_connection(client_socket, client_addr);
-    } catch (const std::exception &e) {
-      ERROR << std::format("Failed to process connection: {}", e.what())
-            << ENDL;
+    if (!server_socket->listen()) {
+      FATAL << "Failed to listen on socket" << ENDL;
+      return -1;
     }
-    client_socket.close();
+    listeners.push_back(std::move(*server_socket));
+  }
+  INFO << std::format("Server listening on {}", listen_addr.to_string())
+       << ENDL;
 
-    DEBUGL << "Connection processed and closed" << ENDL;
+  const bool clean = run_workers(std::move(listeners), config);
+  if (const int signo = shutdown_signal.load()) {
+    INFO << std::format("Received signal {}, shutting down...", signo) << ENDL;
   }
+  if (!clean) {
+    return -1;
+  }
+
   INFO << "Server shutting down gracefully" << ENDL;
-  auto _ = server_socket->shutdown();
   return 0;
 
   // ********************************************************************
@@ -3,7 +3,6 @@
 
 #include <fstream>
 #include <iostream>
-#include <regex>
 #include <string>
 
 #include <arpa/inet.h>